@@ -0,0 +1,162 @@
+#include "BanList.hpp"
+#include "Toolkit.hpp"
+
+BanList::BanList()
+{}
+
+BanList::BanList(const BanList& copy) : _entries(copy._entries)
+{
+	this->_compile();
+}
+
+BanList&	BanList::operator=(const BanList& copy)
+{
+	if (this != &copy) {
+		this->_entries = copy._entries;
+		this->_compile();
+	}
+	return (*this);
+}
+
+BanList::~BanList()
+{
+	_destroy(&this->_by_tail);
+	_destroy(&this->_by_head);
+}
+
+void	BanList::_destroy(Node* node)
+{
+	for (std::map<char, Node*>::iterator it = node->child.begin(); it != node->child.end(); ++it) {
+		_destroy(it->second);
+		delete it->second;
+	}
+	node->child.clear();
+	node->masks.clear();
+}
+
+/*
+ - Completes a mask the way clients abbreviate it: "nick" is nick!*@*, "user@host" is
+   *!user@host and "nick!user" is nick!user@*.
+*/
+std::string	BanList::Normalize(const std::string& mask)
+{
+	bool	has_nick = (mask.find('!') != std::string::npos);
+	bool	has_host = (mask.find('@') != std::string::npos);
+
+	if (!has_nick && !has_host)
+		return (mask + "!*@*");
+	if (!has_nick)
+		return ("*!" + mask);
+	if (!has_host)
+		return (mask + "@*");
+	return (mask);
+}
+
+/*
+ - mask is expected normalized, false when it's already listed (compared casefolded).
+*/
+bool	BanList::Add(const std::string& mask, const std::string& setter, const std::string& set_at)
+{
+	Entry	entry;
+
+	entry.mask = Mask(mask);
+	for (size_t i = 0; i < this->_entries.size(); i++)
+		if (this->_entries[i].mask.getMask() == entry.mask.getMask())
+			return false;
+	entry.setter = setter;
+	entry.set_at = set_at;
+	this->_entries.push_back(entry);
+	this->_compile();
+	return true;
+}
+
+bool	BanList::Remove(const std::string& mask)
+{
+	std::string	folded = _casefold(mask);
+
+	for (size_t i = 0; i < this->_entries.size(); i++) {
+		if (this->_entries[i].mask.getMask() == folded) {
+			this->_entries.erase(this->_entries.begin() + i);
+			this->_compile();
+			return true;
+		}
+	}
+	return false;
+}
+
+const std::vector<BanList::Entry>&	BanList::getEntries() const
+{
+	return (this->_entries);
+}
+
+size_t	BanList::Size() const
+{
+	return (this->_entries.size());
+}
+
+/*
+ - Lists only change on MODE, the tries are rebuilt from scratch each time.
+*/
+void	BanList::_compile()
+{
+	_destroy(&this->_by_tail);
+	_destroy(&this->_by_head);
+	this->_unindexed.clear();
+	for (size_t i = 0; i < this->_entries.size(); i++) {
+		const Mask&	mask = this->_entries[i].mask;
+
+		if (!mask.getTail().empty())
+			_file(&this->_by_tail, std::string(mask.getTail().rbegin(), mask.getTail().rend()), i);
+		else if (!mask.getHead().empty())
+			_file(&this->_by_head, mask.getHead(), i);
+		else
+			this->_unindexed.push_back(i);
+	}
+}
+
+void	BanList::_file(Node* root, const std::string& key, size_t index)
+{
+	Node*	node = root;
+
+	for (size_t i = 0; i < key.length(); i++) {
+		Node*&	next = node->child[key[i]];
+
+		if (!next)
+			next = new Node();
+		node = next;
+	}
+	node->masks.push_back(index);
+}
+
+bool	BanList::_test(const std::vector<size_t>& masks, const std::string& folded) const
+{
+	for (size_t i = 0; i < masks.size(); i++)
+		if (this->_entries[masks[i]].mask.Match(folded))
+			return true;
+	return false;
+}
+
+/*
+ - folded is the casefolded nick!user@host.
+*/
+bool	BanList::Match(const std::string& folded) const
+{
+	const Node*	node = &this->_by_tail;
+
+	for (size_t i = folded.length(); i > 0 && node; i--) {
+		std::map<char, Node*>::const_iterator	it = node->child.find(folded[i - 1]);
+
+		node = (it == node->child.end() ? NULL : it->second);
+		if (node && _test(node->masks, folded))
+			return true;
+	}
+	node = &this->_by_head;
+	for (size_t i = 0; i < folded.length() && node; i++) {
+		std::map<char, Node*>::const_iterator	it = node->child.find(folded[i]);
+
+		node = (it == node->child.end() ? NULL : it->second);
+		if (node && _test(node->masks, folded))
+			return true;
+	}
+	return (_test(this->_unindexed, folded));
+}
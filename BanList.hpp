@@ -0,0 +1,54 @@
+#ifndef BANLIST_HPP
+#define BANLIST_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+#include "Mask.hpp"
+
+/*
+ - A channel's +b (or +e) list: nick!user@host masks compiled once (see Mask).
+ - Match() doesn't try every mask. A mask ending in literal text ("*!*@*.example.com") is filed
+   in a trie on that tail reversed, one ending in a wildcard under its literal head
+   ("spam*!*@*") in a trie on the head: the subject's end and start are walked down both and
+   only the masks met on the way are tested. Masks with neither ("*!*bot*@*") are all tested.
+*/
+class BanList {
+	public:
+		struct Entry {
+			Mask		mask;
+			std::string	setter;
+			std::string	set_at;
+		};
+
+		BanList();
+		BanList(const BanList& copy);
+		BanList&	operator=(const BanList& copy);
+		~BanList();
+
+		bool						Add(const std::string& mask, const std::string& setter, const std::string& set_at);
+		bool						Remove(const std::string& mask);
+		bool						Match(const std::string& folded) const;
+		const std::vector<Entry>&	getEntries() const;
+		size_t						Size() const;
+
+		static std::string			Normalize(const std::string& mask);
+
+	private:
+		struct Node {
+			std::map<char, Node*>	child;
+			std::vector<size_t>		masks; // indexes in _entries
+		};
+
+		std::vector<Entry>	_entries;
+		Node				_by_tail;
+		Node				_by_head;
+		std::vector<size_t>	_unindexed;
+
+		void		_compile();
+		bool		_test(const std::vector<size_t>& masks, const std::string& folded) const;
+		static void	_file(Node* root, const std::string& key, size_t index);
+		static void	_destroy(Node* node);
+};
+
+#endif // BANLIST_HPP
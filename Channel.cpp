@@ -21,7 +21,8 @@ _has_password(false),
 _invite_only(false),
 _has_topic(false),
 _topic_priv(true),
-_creation_time(time(NULL))
+_creation_time(time(NULL)),
+_cache_valid(true)
 {}
 
 Channel::Channel(const std::string& name, const std::string& password) :
@@ -32,7 +33,8 @@ _invite_only(false),
 _has_topic(false),
 _topic_priv(true),
 _password(password),
-_creation_time(time(NULL))
+_creation_time(time(NULL)),
+_cache_valid(true)
 {}
 
 Channel::~Channel()
@@ -134,40 +136,107 @@ bool			Channel::onChannel(Client &client)
 	return (std::find(this->_members.begin(), this->_members.end(), client) != this->_members.end());
 }
 
-void			Channel::sendToAll(Client &client, std::string msg)
+void			Channel::sendToAll(Client &client, const std::string& msg, MessagePriority priority)
 {
 	for (size_t i = 0; i < this->_members.size(); i++)
 		if (this->_members[i] != client)
-			this->_members[i].getClient()->SetMessage(msg);
+			this->_members[i].getClient()->SetMessage(msg, priority);
 }
+/*
+ - Part of a fan-out over several channels (Server::SendToNeighbors()): members already
+   stamped with this generation got the line from an earlier channel and are skipped.
+*/
+void			Channel::sendToUnmarked(unsigned long long generation, const std::string& msg, MessagePriority priority)
+{
+	for (size_t i = 0; i < this->_members.size(); i++)
+		if (this->_members[i].getClient()->MarkFanout(generation))
+			this->_members[i].getClient()->SetMessage(msg, priority);
+}
+
 void			Channel::_add_member(Client &client, bool role)
 {
 	if (!this->onChannel(client))
+	{
 		this->_members.push_back(Member(client, role, role));
+		if (this->_cache_valid)
+			this->_cache_member(this->_members.back());
+	}
 }
 
 void			Channel::removeMember(Client &client)
 {
-	std::vector<Client>::iterator invited_it;
-	invited_it = std::find(this->_invited.begin(), this->_invited.end(), client);
-	if (invited_it != this->_invited.end())
-		this->_invited.erase(std::remove(this->_invited.begin(), this->_invited.end(), client));
 	if (this->onChannel(client))
+	{
 		this->_members.erase(std::remove(this->_members.begin(), this->_members.end(), client));
+		this->memberChanged();
+	}
+}
+
+/*
+ - Drops the NAMES/WHO caches, they're rebuilt by the next NAMES or WHO. Called when a member
+   leaves, changes nick or gains/loses op; joins are appended to the caches instead.
+*/
+void			Channel::memberChanged()
+{
+	this->_cache_valid = false;
+	this->_names_chunks.clear();
+	this->_who_fragments.clear();
+}
+
+void			Channel::_cache_member(const Member& member)
+{
+	Client*		client = member.getClient();
+	std::string	name = ((member.getOperatorPriv() && client->getNick() != "irc_bot") ? "@" : "") + client->getNick() + " ";
+
+	if (this->_names_chunks.empty() || this->_names_chunks.back().length() + name.length() > NAMES_CHUNK_BYTES)
+		this->_names_chunks.push_back(std::string());
+	this->_names_chunks.back() += name;
+	// the reply without its "352 <nick>" head, which is the only part depending on who asks
+	this->_who_fragments.push_back(RPL_WHOREPLY(std::string(),
+								  this->_name,
+								  client->getName(),
+								  client->getHostname(),
+								  client->getServername(),
+								  client->getNick(),
+								  (member.getOperatorPriv() ? "@" : ""),
+								  client->getRealname()).substr(4));
+}
+
+void			Channel::_refresh_cache()
+{
+	if (this->_cache_valid)
+		return ;
+	for (size_t i = 0; i < this->_members.size(); i++)
+		this->_cache_member(this->_members[i]);
+	this->_cache_valid = true;
 }
 
 void 			Channel::join(Client &client)
+{
+	std::string burst;
+
+	this->join(client, burst);
+	client.SetMessage(burst);
+}
+
+/*
+ - Appends the joining client's replies (JOIN, TOPIC, NAMES or the error) to burst instead of
+   queueing them, so a multi-channel JOIN hands the whole burst to the client in one go.
+*/
+void 			Channel::join(Client &client, std::string& burst)
 {
 	std::string messageToSend;
-	if (this->_invite_only && 
-			(std::find(this->_invited.begin(), this->_invited.end(), client) == this->_invited.end()))
-		client.SetMessage(ERR_INVITEONLYCHAN(client.getNick(), this->_name) + "\r\n");
+	if (this->isBanned(client))
+		burst += _user_info(client, false) + ERR_BANNEDFROMCHAN(client.getNick(), this->_name);
+	else if (this->_invite_only && !this->isInvited(client))
+		burst += ERR_INVITEONLYCHAN(client.getNick(), this->_name) + "\r\n";
 	else
 	{
 		if ((int)this->_members.size() >= this->_size && this->_size != -1)
-			client.SetMessage(_user_info(client, true) + ERR_CHANNELISFULL(client.getNick(), this->_name) + "\r\n");
+			burst += _user_info(client, true) + ERR_CHANNELISFULL(client.getNick(), this->_name) + "\r\n";
 		else
 		{
+			this->_invites.Erase(client.GetId()); // used up
 			if (client.getNick() == "irc_bot")
 				this->_add_member(client, true);
 			else if (this->_members.size() == 0 || (this->_members.size() == 1 && this->_members[0].getClient()->getNick() == "irc_bot"))
@@ -177,9 +246,9 @@ void 			Channel::join(Client &client)
 			messageToSend += _user_info(client, true) + "JOIN " + this->_name + " * :" + client.getRealname() + "\r\n";
 			messageToSend += (this->_topic.empty() ? "" : ( _user_info(client, false) + RPL_TOPIC(client.getNick(), this->_name, this->_topic) ));
 			messageToSend += (this->_topic.empty() ? "" : ( _user_info(client, false) + RPL_TOPICWHOTIME(client.getNick(), this->_name, this->_topic_setter, this->_time_topic_is_set) ));
-			messageToSend += _user_info(client, false) + this->showUsers(client);
+			messageToSend += this->showUsers(client);
 			messageToSend += _user_info(client, false) + RPL_ENDOFNAMES(client.getNick(), this->_name);
-			client.SetMessage(messageToSend);
+			burst += messageToSend;
 			messageToSend = _user_info(client, true) + "JOIN " + this->_name + " * :" + client.getRealname() + "\r\n";
 			this->sendToAll(client, messageToSend);
 		}
@@ -274,6 +343,18 @@ std::pair<int, std::string>		Channel::channelMode(Client &client, bool add_remov
 			this->_topic_priv = add_remove;
 			hold_message_return.first = 1;
 		}
+		else if (mode == 'b' || mode == 'e')
+		{
+			BanList&	list = (mode == 'b' ? this->_bans : this->_exceptions);
+
+			if (add_remove && list.Size() >= MAX_CHANNEL_BANS)
+				send_to_client = _user_info(client, false) + ERR_BANLISTFULL(client.getNick(), this->_name, mode);
+			else if (add_remove ? list.Add(param, client.getNick(), this->_get_time()) : list.Remove(param))
+			{
+				this->_ban_status.Clear();
+				hold_message_return.first = 1;
+			}
+		}
 		else if (mode == 'k')
 		{
 			if (param.empty())
@@ -313,6 +394,7 @@ std::pair<int, std::string>		Channel::memberMode(Client &client, bool add_remove
 		else if (mode == 'o')
 		{
 			member_it->setOperatorPriv(add_remove);
+			this->memberChanged();
 			hold_message_return.first = 1;
 		}
 	}
@@ -335,7 +417,10 @@ void			Channel::invite(Client& client, Client &invited)
 		client.SetMessage(_user_info(client, false) + ERR_USERONCHANNEL(client.getNick(), invited.getNick(), this->_name));
 	else
 	{
-		this->_invited.push_back(invited);
+		size_t	expiry = _gettime() + INVITE_EXPIRY_SECONDS;
+
+		this->_invites[invited.GetId()] = expiry;
+		this->_invite_order.push_back(std::make_pair(expiry, invited.GetId()));
 		client.SetMessage(_user_info(client, false) + RPL_INVITING(client.getNick(), invited.getNick(), this->_name));
 		invited.SetMessage(_user_info(client, true) + "INVITE " + invited.getNick() + " " + this->_name + "\r\n");
 	}
@@ -370,35 +455,145 @@ void			Channel::topic(Client &client, bool topic_exist, std::string topic)
 	}
 }
 
-void			Channel::who(Client &client)
+/*
+ - Queues the WHO replies from member cursor on, stopping once about max_bytes are queued,
+   and returns true after the last one (followed by RPL_ENDOFWHO). cursor is left on the next
+   member: members leaving or joining between two calls can be skipped or listed twice.
+ - Replies are copied out of the member cache, only their head depends on who's asking.
+*/
+bool			Channel::who(Client &client, size_t& cursor, size_t max_bytes)
 {
 	std::string who_reply;
-	for (size_t i = 0; i < this->_members.size(); i++)
+	std::string head = ":" + client.getServername() + " 352 " + client.getNick();
+
+	this->_refresh_cache();
+	who_reply.reserve(std::min((head.length() + 96) * (this->_who_fragments.size() - std::min(cursor, this->_who_fragments.size())), max_bytes + 512) + 64);
+	while (cursor < this->_who_fragments.size() && who_reply.length() < max_bytes)
 	{
-		who_reply += ":" + client.getServername() + " ";
-		who_reply += RPL_WHOREPLY(client.getNick(), 
-								  this->_name,
-								  this->_members[i].getClient()->getName(), 
-								  this->_members[i].getClient()->getHostname(), 
-								  this->_members[i].getClient()->getServername(), 
-								  this->_members[i].getClient()->getNick(),
-								  (this->_members[i].getOperatorPriv() ? "@" : ""),
-								  this->_members[i].getClient()->getRealname());
+		who_reply += head;
+		who_reply += this->_who_fragments[cursor++];
 	}
-	who_reply += _user_info(client, false) + RPL_ENDOFWHO(client.getNick(), this->_name);
+	if (cursor >= this->_who_fragments.size())
+		who_reply += _user_info(client, false) + RPL_ENDOFWHO(client.getNick(), this->_name);
 	client.SetMessage(who_reply);
+	return (cursor >= this->_who_fragments.size());
 }
-std::string		Channel::showUsers(Client& client) const
+
+/*
+ - RPL_NAMREPLY lines, one per NAMES_CHUNK_BYTES of names, each with the server prefix.
+*/
+std::string		Channel::showUsers(Client& client)
 {
 	std::string users;
-	users += "353 " + client.getNick() + " = " + this->_name + " :";
-	for(size_t i = 0; i < this->_members.size(); i++)
-		users += ((this->_members[i].getOperatorPriv() && this->_members[i].getClient()->getNick() != "irc_bot") ? "@" : "")  + this->_members[i].getClient()->getNick() + " ";
-	users += "\r\n";
+	std::string head = _user_info(client, false) + "353 " + client.getNick() + " = " + this->_name + " :";
+
+	this->_refresh_cache();
+	if (this->_names_chunks.empty())
+		return (head + "\r\n");
+	users.reserve((head.length() + NAMES_CHUNK_BYTES + 2) * this->_names_chunks.size());
+	for (size_t i = 0; i < this->_names_chunks.size(); i++)
+	{
+		users += head;
+		users += this->_names_chunks[i];
+		users += "\r\n";
+	}
 	return (users);
 }
 
 
+/*
+ - Whether client's nick!user@host matches a +b mask and no +e one. host is tried both as the
+   hostname sent with USER, which the client picks, and as the peer address (the servername,
+   inet_ntoa() of the socket), so address bans hold whatever USER said.
+ - Answers are cached per client
+   until the lists change (MODE +b/-b/+e/-e) or forgetClient() is called on a nick change or
+   disconnect, a channel without bans never builds the cache.
+*/
+bool			Channel::isBanned(Client &client)
+{
+	bool*	cached;
+	bool	banned;
+
+	if (this->_bans.Size() == 0)
+		return false;
+	if ((cached = this->_ban_status.Find(&client)) != NULL)
+		return (*cached);
+	std::string	source = _casefold(client.getNick() + "!" + client.getName() + "@");
+	std::string	by_host = source + _casefold(client.getHostname());
+	std::string	by_address = source + client.getServername();
+
+	banned = ((this->_bans.Match(by_host) || this->_bans.Match(by_address))
+		&& !this->_exceptions.Match(by_host) && !this->_exceptions.Match(by_address));
+	this->_ban_status[&client] = banned;
+	return (banned);
+}
+
+/*
+ - Banned members can still read the channel but not send to it, unless they're operators.
+*/
+bool			Channel::canSpeak(Client &client)
+{
+	std::vector<Member>::iterator	member_it = std::find(this->_members.begin(), this->_members.end(), client);
+
+	if (member_it != this->_members.end() && member_it->getOperatorPriv())
+		return true;
+	return (!this->isBanned(client));
+}
+
+/*
+ - An invite lets its client in once, within INVITE_EXPIRY_SECONDS. Invites are keyed on the
+   client id, a later connection reusing the socket fd doesn't inherit them.
+*/
+bool			Channel::isInvited(Client &client)
+{
+	size_t*	expiry = this->_invites.Find(client.GetId());
+
+	return (expiry && *expiry > _gettime());
+}
+
+/*
+ - Drops the invites that expired by now, oldest first. A client invited again has a later entry
+   queued, the older one only removes the invite if its expiry is still the current one.
+*/
+void			Channel::reapInvites(size_t now)
+{
+	while (!this->_invite_order.empty() && this->_invite_order.front().first <= now)
+	{
+		size_t*	expiry = this->_invites.Find(this->_invite_order.front().second);
+
+		if (expiry && *expiry == this->_invite_order.front().first)
+			this->_invites.Erase(this->_invite_order.front().second);
+		this->_invite_order.pop_front();
+	}
+}
+
+void			Channel::forgetClient(Client &client)
+{
+	this->_ban_status.Erase(&client);
+}
+
+/*
+ - MODE #chan b / MODE #chan e: the masks with who set them and when.
+*/
+std::string		Channel::banList(Client &client, char mode)
+{
+	const std::vector<BanList::Entry>&	entries = (mode == 'b' ? this->_bans : this->_exceptions).getEntries();
+	std::string							reply;
+
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		if (mode == 'b')
+			reply += _user_info(client, false) + RPL_BANLIST(client.getNick(), this->_name, entries[i].mask.getMask(), entries[i].setter, entries[i].set_at);
+		else
+			reply += _user_info(client, false) + RPL_EXCEPTLIST(client.getNick(), this->_name, entries[i].mask.getMask(), entries[i].setter, entries[i].set_at);
+	}
+	if (mode == 'b')
+		reply += _user_info(client, false) + RPL_ENDOFBANLIST(client.getNick(), this->_name);
+	else
+		reply += _user_info(client, false) + RPL_ENDOFEXCEPTLIST(client.getNick(), this->_name);
+	return (reply);
+}
+
 void		 	Channel::mode(Client &client)
 {
 	std::string 		msg_to_send;
@@ -418,16 +613,16 @@ void		 	Channel::mode(Client &client)
 	client.SetMessage(msg_to_send);
 }
 
-void			Channel::sendToOperators(Client &client, std::string msg)
+void			Channel::sendToOperators(Client &client, const std::string& msg, MessagePriority priority)
 {
 	for (size_t i = 0; i < this->_members.size(); i++)
 		if (this->_members[i] != client && this->_members[i].getOperatorPriv())
-			this->_members[i].getClient()->SetMessage(msg);
+			this->_members[i].getClient()->SetMessage(msg, priority);
 }
 
-void			Channel::sendToFounder(Client &client, std::string msg)
+void			Channel::sendToFounder(Client &client, const std::string& msg, MessagePriority priority)
 {
 	for (size_t i = 0; i < this->_members.size(); i++)
 		if (this->_members[i] != client && this->_members[i].getFounderPriv())
-			this->_members[i].getClient()->SetMessage(msg);
+			this->_members[i].getClient()->SetMessage(msg, priority);
 }
@@ -21,7 +21,10 @@
 #include "Client.hpp"
 #include "Member.hpp"
 #include <sstream>
+#include <deque>
 #include "Toolkit.hpp"
+#include "HashMap.hpp"
+#include "BanList.hpp"
 
 #define MAX_SIZE 75
 #define ERR_NEEDMOREPARAMS(client, command)										("461 " + client + " " + command + " :Not enough parameters\r\n")
@@ -44,6 +47,12 @@
 #define RPL_NAMREPLY(prefix, nick) 												(prefix + nick + " ")
 #define RPL_ENDOFNAMES(client, channel) 										("366 " + client + " " + channel + " :End of /NAMES list.\r\n")
 #define RPL_INVITING(client, nick, channel) 									("341 " + client + " " + nick + " " + channel + "\r\n")
+#define ERR_CANNOTSENDTOCHAN(client, channel)									("404 " + client + " " + channel + " :Cannot send to channel\r\n")
+#define ERR_BANLISTFULL(client, channel, mode)									("478 " + client + " " + channel + " " + mode + " :Channel list is full\r\n")
+#define RPL_BANLIST(client, channel, mask, setter, set_at)						("367 " + client + " " + channel + " " + mask + " " + setter + " " + set_at + "\r\n")
+#define RPL_ENDOFBANLIST(client, channel)										("368 " + client + " " + channel + " :End of channel ban list\r\n")
+#define RPL_EXCEPTLIST(client, channel, mask, setter, set_at)					("348 " + client + " " + channel + " " + mask + " " + setter + " " + set_at + "\r\n")
+#define RPL_ENDOFEXCEPTLIST(client, channel)									("349 " + client + " " + channel + " :End of channel exception list\r\n")
 #define ERR_UNKNOWNMODE(client, modechar)										("472 " + client + " " + modechar + " :is unknown mode char to me\r\n")
 
 
@@ -52,6 +61,27 @@
 
 #define RPL_CHANNELMODEIS(client, channel, modes)								("324 " + client + " " + channel + " " + modes + "\r\n")
 #define RPL_CREATIONTIME(client, channel, creationtime)							("329 " + client + " " + channel + " " + creationtime + "\r\n")
+// NAMES names per 353 line, room is left for ":<server> 353 <nick> = <channel> :" within 512 bytes
+#define NAMES_CHUNK_BYTES 400
+#define MAX_CHANNEL_BANS 100 // per list, +b and +e
+#define INVITE_EXPIRY_SECONDS 3600
+
+struct ClientPtrHash {
+	size_t	operator()(const Client* client) const
+	{
+		size_t	h = (size_t)client;
+
+		return ((h >> 4) ^ (h >> 12));
+	}
+};
+
+struct ClientIdHash {
+	size_t	operator()(unsigned long long id) const
+	{
+		return ((size_t)((id * 0x9E3779B97F4A7C15ULL) >> 32));
+	}
+};
+
 // numeric 
 class Channel 
 {
@@ -67,10 +97,19 @@ class Channel
 		std::string 		_topic_setter;
 		std::string 		_time_topic_is_set;
 		time_t				_creation_time;
-		std::vector<Client>	_invited;
+		HashMap<unsigned long long, size_t, ClientIdHash>	_invites; // client id -> expiry (_gettime())
+		std::deque<std::pair<size_t, unsigned long long> >	_invite_order; // (expiry, client id), oldest first
 		std::vector<Member>	_members;
+		std::vector<std::string>	_names_chunks; // NAMES list split in NAMES_CHUNK_BYTES pieces
+		std::vector<std::string>	_who_fragments; // WHO reply of each member after "352 <nick>"
+		bool				_cache_valid;
+		BanList				_bans;
+		BanList				_exceptions;
+		HashMap<const Client*, bool, ClientPtrHash>	_ban_status; // isBanned() results until a list or the client's nick changes
 		void				_set_topic(const std::string& t, std::string setterName);
 		void				_add_member(Client &client, bool role);
+		void				_cache_member(const Member& member);
+		void				_refresh_cache();
 		std::string			_get_time();
 
 	public:
@@ -98,19 +137,28 @@ class Channel
 		
 		bool						onChannel(Client &client);
 		void 						join(Client &client);
+		void 						join(Client &client, std::string& burst);
 		void 						part(Client &client, std::string reason);
 		void						kick(Client &client, Client &kicked, std::string reason);
 		void						topic(Client &client, bool topic_exist, std::string topic);
-		void						who(Client &client); // execute when a client send " WHO #channel_name "
+		bool						who(Client &client, size_t& cursor, size_t max_bytes); // execute when a client send " WHO #channel_name "
 		void						invite(Client& client, Client &invited);
-		void						sendToAll(Client &client, std::string msg);
-		void						sendToOperators(Client &client, std::string msg);
-		void						sendToFounder(Client &client, std::string msg);
-		std::string					showUsers(Client& client) const;
+		void						sendToAll(Client &client, const std::string& msg, MessagePriority priority = PRIORITY_CONTROL);
+		void						sendToOperators(Client &client, const std::string& msg, MessagePriority priority = PRIORITY_CONTROL);
+		void						sendToFounder(Client &client, const std::string& msg, MessagePriority priority = PRIORITY_CONTROL);
+		void						sendToUnmarked(unsigned long long generation, const std::string& msg, MessagePriority priority = PRIORITY_CONTROL);
+		std::string					showUsers(Client& client);
 		void		 				mode(Client &client);
 		std::pair<int, std::string>	memberMode(Client &client, bool add_remove, char mode, Client& member);
 		std::pair<int, std::string>	channelMode(Client &client, bool add_remove, char mode, std::string param);
 		void						removeMember(Client &client);
+		void						memberChanged();
+		bool						isBanned(Client &client);
+		bool						canSpeak(Client &client);
+		std::string					banList(Client &client, char mode);
+		void						forgetClient(Client &client);
+		bool						isInvited(Client &client);
+		void						reapInvites(size_t now);
 	
 		bool						operator==(const std::string& c);
 		bool						operator!=(const std::string& c);
@@ -14,32 +14,40 @@
 #include "Server.hpp"
 
 
-Client::Client() :  nick(""), socket_id(-1), just_connected(0), should_be_kicked(0), last_user_activity(_gettime()) { }
+static unsigned long long	s_last_client_id = 0;
 
-Client::Client(const Client& copy) : nick(copy.nick), socket_id(copy.getSockID()), just_connected(copy.JustConnectedStatus()), should_be_kicked(copy.should_be_kicked), last_user_activity(copy.last_user_activity) {}
+ClientInfo::ClientInfo()
+{
+	_bzero(&this->address, sizeof(this->address));
+}
+
+Client::Client() : socket_id(-1), just_connected(0), should_be_kicked(0), flood_exempt(false), scheduled(false), flush_pending(false), write_blocked(false), last_user_activity(_gettime()), flood_timer(0), fanout_stamp(0), shed_messages(0), id(0), flush_queue(NULL), tls(NULL), prefix(":!@ "), info(new ClientInfo()) { }
+
+Client::Client(const Client& copy) : socket_id(copy.getSockID()), just_connected(copy.JustConnectedStatus()), should_be_kicked(copy.should_be_kicked), flood_exempt(copy.flood_exempt), scheduled(copy.scheduled), flush_pending(false), write_blocked(false), last_user_activity(copy.last_user_activity), flood_timer(copy.flood_timer), fanout_stamp(0), shed_messages(0), id(copy.id), flush_queue(NULL), tls(copy.tls), nick(copy.nick), prefix(copy.prefix), info(new ClientInfo(*copy.info)) {}
 
 Client &Client::operator=(const Client& copy) {
 	if (&copy != this) {
-		name = copy.name;
 		socket_id = copy.socket_id;
 		just_connected = copy.just_connected;
 		should_be_kicked = copy.should_be_kicked;
         last_user_activity = copy.last_user_activity;
+        flood_timer = copy.flood_timer;
+        flood_exempt = copy.flood_exempt;
+        scheduled = copy.scheduled;
+        tls = copy.tls;
+        id = copy.id;
+        nick = copy.nick;
+        prefix = copy.prefix;
+        *info = *copy.info;
 	}
 	return *this;
 }
 
 Client::~Client()  {
-
+	delete this->info;
 }
 
-Client::Client(int socket_id, bool just_connected) {
-    Client();
-	this->socket_id = socket_id;
-	this->just_connected = just_connected;
-    this->last_user_activity = _gettime();
-	
-}
+Client::Client(int socket_id, bool just_connected) : socket_id(socket_id), just_connected(just_connected), should_be_kicked(0), flood_exempt(false), scheduled(false), flush_pending(false), write_blocked(false), last_user_activity(_gettime()), flood_timer(0), fanout_stamp(0), shed_messages(0), id(++s_last_client_id), flush_queue(NULL), tls(NULL), prefix(":!@ "), info(new ClientInfo()) { }
 
 int Client::getSockID() const {
 	return (this->socket_id);
@@ -82,6 +90,10 @@ void	Client::SetBuffer(const std::string& buffer) {
 	this->raw_data = buffer;
 }
 
+void	Client::AppendBuffer(const char *data, size_t len) {
+	this->raw_data.append(data, len);
+}
+
 const std::string&	Client::GetBuffer(void) const {
 	return (this->raw_data);
 }
@@ -90,44 +102,242 @@ std::string&	Client::GetMessageBuffer(void) {
 	return (this->send_buffer);
 }
 
-void	Client::SetMessage(const std::string& buffer) {
-	send_buffer = buffer;
+const std::string&	Client::GetMessageBuffer(void) const {
+	return (this->send_buffer);
+}
+
+std::string&	Client::GetBulkBuffer(void) {
+	return (this->bulk_buffer);
+}
+
+/*
+	- Queues output for the client, it's sent by the server's flush at the end of the loop tick
+	  together with everything else queued for it during the tick.
+	- Bulk messages that would take the queued output past MAX_IRC_SENDQ are dropped, control
+	  messages are always queued.
+	- The first message of a tick puts the client on its server's flush queue, copies of a client
+	  have no queue and what's queued on them is never sent.
+*/
+void	Client::SetMessage(const std::string& buffer, MessagePriority priority) {
+	if (buffer.empty())
+		return ;
+	if (priority == PRIORITY_BULK) {
+		if (QueuedBytes() + buffer.length() > MAX_IRC_SENDQ) {
+			++this->shed_messages;
+			return ;
+		}
+		bulk_buffer += buffer;
+	}
+	else
+		send_buffer += buffer;
+	if (!this->flush_pending && this->flush_queue) {
+		this->flush_pending = true;
+		this->flush_queue->push_back(this);
+	}
+}
+
+/*
+	- Drops the first len bytes of the output once send() took them, control first then bulk.
+	- A bulk line that only went out in part is moved to the control queue, so that control
+	  queued later goes after it instead of landing in the middle of it.
+*/
+void	Client::ConsumeMessage(size_t len) {
+	size_t from_control = (len < send_buffer.length() ? len : send_buffer.length());
+
+	send_buffer.erase(0, from_control);
+	len -= from_control;
+	if (len == 0)
+		return ;
+	bool mid_line = (bulk_buffer[len - 1] != '\n');
+	bulk_buffer.erase(0, len);
+	if (mid_line) {
+		size_t end = bulk_buffer.find('\n');
+		size_t rest = (end == std::string::npos ? bulk_buffer.length() : end + 1);
+
+		send_buffer.assign(bulk_buffer, 0, rest);
+		bulk_buffer.erase(0, rest);
+	}
+}
+
+void	Client::DropMessages(void) {
+	send_buffer.clear();
+	bulk_buffer.clear();
+}
+
+size_t	Client::QueuedBytes(void) const {
+	return (send_buffer.length() + bulk_buffer.length());
+}
+
+unsigned long long	Client::GetShedCount(void) const {
+	return (this->shed_messages);
+}
+
+void	Client::SetFlushQueue(std::vector<Client*>* queue) {
+	this->flush_queue = queue;
+}
+
+bool	Client::IsFlushPending() const {
+	return (this->flush_pending);
+}
+
+void	Client::SetFlushPending(bool status) {
+	this->flush_pending = status;
+}
+
+bool	Client::IsWriteBlocked() const {
+	return (this->write_blocked);
+}
+
+void	Client::SetWriteBlocked(bool status) {
+	this->write_blocked = status;
+}
+
+/*
+	- Takes the first complete line out of the receive buffer, without its "\r\n".
+	- Returns false and leaves the buffer untouched if no full line has arrived yet.
+*/
+bool	Client::PopLine(std::string& line) {
+	size_t end = this->raw_data.find('\n');
+
+	if (end == std::string::npos)
+		return false;
+	size_t len = end;
+	while (len > 0 && this->raw_data[len - 1] == '\r')
+		--len;
+	line.assign(this->raw_data, 0, len);
+	this->raw_data.erase(0, end + 1);
+	return true;
+}
+
+bool	Client::HasPendingLine() const {
+	return (this->raw_data.find('\n') != std::string::npos);
+}
+
+/*
+	- RFC 1459 flood control: every command pushes the client's message timer forward by its
+	  penalty, lines are only processed while the timer is less than FLOOD_BURST_MS ahead of now.
+	- That's a token bucket holding FLOOD_BURST_MS worth of penalties, refilled at one ms per ms.
+*/
+bool	Client::CanProcessLine(unsigned long long now_ms) const {
+	return (this->flood_exempt || this->flood_timer < now_ms + FLOOD_BURST_MS);
+}
+
+/*
+	- How long until CanProcessLine() turns true, 0 if it already is.
+*/
+unsigned long long	Client::FloodWaitMs(unsigned long long now_ms) const {
+	if (CanProcessLine(now_ms))
+		return 0;
+	return (this->flood_timer - (now_ms + FLOOD_BURST_MS) + 1);
+}
+
+void	Client::AddFloodPenalty(unsigned long long now_ms, unsigned int penalty_ms) {
+	if (this->flood_timer < now_ms)
+		this->flood_timer = now_ms;
+	this->flood_timer += penalty_ms;
+}
+
+bool	Client::IsFloodExempt() const {
+	return (this->flood_exempt);
+}
+
+void	Client::SetFloodExempt(bool exempt) {
+	this->flood_exempt = exempt;
+}
+
+bool	Client::IsScheduled() const {
+	return (this->scheduled);
+}
+
+void	Client::SetScheduled(bool status) {
+	this->scheduled = status;
+}
+
+/*
+	- Stamps the client for the fan-out numbered generation, false if it already was.
+*/
+bool	Client::MarkFanout(unsigned long long generation) {
+	if (this->fanout_stamp == generation)
+		return false;
+	this->fanout_stamp = generation;
+	return true;
+}
+
+unsigned long long	Client::GetId() const {
+	return (this->id);
+}
+
+TlsConnection*	Client::GetTls() const {
+	return (this->tls);
+}
+
+void	Client::SetTls(TlsConnection* tls) {
+	this->tls = tls;
 }
 
 const std::string& Client::getNick() const {
+    return (this->nick.get());
+}
+
+const IString& Client::getInternedNick() const {
     return (this->nick);
 }
 
+const IString& Client::getInternedHostname() const {
+    return (this->info->hostname);
+}
+
 void    Client::SetName(const std::string &name) {
-    this->name = name;
+    this->info->name = IString(name);
+    _update_prefix();
 }
 
 void    Client::SetHostname(const std::string &hostname) {
-    this->hostname = hostname;
+    this->info->hostname = IString(hostname);
+    _update_prefix();
 }
 
 void    Client::SetServername(const std::string &servername) {
-    this->servername = servername;
+    this->info->servername = IString(servername);
 }
 
 void    Client::SetRealname(const std::string &realname) {
-    this->realname = realname;
+    this->info->realname = IString(realname);
 }
 
 const std::string& Client::getName() const {
-    return this->name;
+    return this->info->name.get();
 }
 
 const std::string& Client::getHostname() const {
-    return this->hostname;
+    return this->info->hostname.get();
 }
 
 const std::string& Client::getServername() const {
-    return this->servername;
+    return this->info->servername.get();
 }
 
 const std::string& Client::getRealname() const {
-    return this->realname;
+    return this->info->realname.get();
+}
+
+/*
+	- ":nick!user@host ", the source of every message the client sends to others.
+*/
+const std::string& Client::GetPrefix() const {
+    return this->prefix;
+}
+
+void    Client::_update_prefix() {
+    this->prefix = ":" + this->nick.get() + "!" + this->info->name.get() + "@" + this->info->hostname.get() + " ";
+}
+
+const struct sockaddr_in& Client::GetAddress() const {
+    return this->info->address;
+}
+
+void    Client::SetAddress(const struct sockaddr_in& address) {
+    this->info->address = address;
 }
 
 bool		Client::operator==(const Client& c)
@@ -135,9 +345,12 @@ bool		Client::operator==(const Client& c)
 	return (this->socket_id == c.getSockID());
 }
 
-bool		Client::operator==(const std::string& s)
+/*
+	- Nick lookups, casefolded (RFC 1459) and by pointer: both sides are interned.
+*/
+bool		Client::operator==(const IString& nick)
 {
-	return (this->nick == s);
+	return (this->nick.SameFolded(nick));
 }
 
 bool    Client::operator==(int c) {
@@ -151,7 +364,8 @@ bool		Client::operator!=(const Client& c)
 
 void		Client::SetNick(const std::string& name)
 {
-	this->nick = name;
+	this->nick = IString(name);
+	_update_prefix();
 }
 
 std::ostream& operator<<(std::ostream& os, Client &client)
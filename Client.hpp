@@ -21,6 +21,23 @@
 #include <netdb.h>
 #include <sys/time.h>
 #include "Toolkit.hpp"
+#include "IString.hpp"
+
+#define FLOOD_BURST_MS 10000
+#define MAX_IRC_SENDQ 65536
+#define SENDQ_LOW_WATERMARK 16384 // streamed replies (Server::StreamReply) are only extended below this
+
+struct TlsConnection;
+
+/*
+ - Control output (replies to the client's own commands, PONG, KICK/MODE/JOIN notices) is
+   always sent ahead of bulk output (chat relayed from others), and bulk is what gets shed
+   when the client's SendQ is full.
+*/
+enum MessagePriority {
+	PRIORITY_CONTROL,
+	PRIORITY_BULK
+};
 
 struct AddressDataClient {
 	public:
@@ -30,26 +47,46 @@ struct AddressDataClient {
 		int 				server_socket_fd;
 };
 
+/*
+ - Cold half of a Client: identity and peer address, read on registration, WHO, bans and
+   disconnect rather than on every line. It's allocated apart so the fields the event loop goes
+   through (socket, flags, timers, queues, prefix) stay packed in the Client itself.
+*/
 struct ClientInfo {
-    protected:
-        std::string name;
-        std::string hostname;
-        std::string servername;
-        std::string realname;
+	IString				name;
+	IString				hostname;
+	IString				servername; // the peer's address, shared by every client from it
+	IString				realname;
+	struct sockaddr_in	address;
+
+	ClientInfo();
 };
 
-class Client : public AddressDataClient, public ClientInfo
+class Client
 {
 	private:
-		std::string	 	nick;
 		int	 			socket_id;
-		//int  channel_id;
 		bool 			just_connected;
 		bool			should_be_kicked;
+		bool			flood_exempt;
+		bool			scheduled; // queued in the server's ready queue
+		bool			flush_pending; // queued in the server's flush queue
+		bool			write_blocked; // output left over from the last flush, waiting on POLLOUT
+		unsigned long   last_user_activity;
+		unsigned long long	flood_timer; // ms, RFC 1459 message timer
+		unsigned long long	fanout_stamp; // generation of the last multi-channel notice it got
+		unsigned long long	shed_messages; // bulk messages dropped for a full SendQ
+		unsigned long long	id; // never reused, unlike the socket fd (0 for a default constructed client)
+		std::vector<Client*>*	flush_queue;
+		TlsConnection*	tls; // owned by the server's TlsContext, NULL on plain connections
 		std::string		raw_data;
 		std::string		send_buffer; // the message from server
-		unsigned long   last_user_activity;
-		
+		std::string		bulk_buffer; // relayed chat, sent after send_buffer
+		IString			nick;
+		std::string		prefix; // ":nick!user@host ", rebuilt when one of them changes
+		ClientInfo*		info; // owned
+
+		void			_update_prefix();
 		//bool			IsOperator;
 		
 	public:
@@ -66,8 +103,37 @@ class Client : public AddressDataClient, public ClientInfo
 		const std::string&	GetBuffer(void) const;
 		void				SetJustConnectedStatus(bool status);
 		std::string&		GetMessageBuffer(void);
+		const std::string&	GetMessageBuffer(void) const;
 		void				SetBuffer(const std::string& buffer);
-		void				SetMessage(const std::string& buffer);
+		void				AppendBuffer(const char *data, size_t len);
+		std::string&		GetBulkBuffer(void);
+		void				SetMessage(const std::string& buffer, MessagePriority priority = PRIORITY_CONTROL);
+		void				ConsumeMessage(size_t len);
+		void				DropMessages(void);
+		size_t				QueuedBytes(void) const;
+		unsigned long long	GetShedCount(void) const;
+		void				SetFlushQueue(std::vector<Client*>* queue);
+		bool				IsFlushPending() const;
+		void				SetFlushPending(bool status);
+		bool				IsWriteBlocked() const;
+		void				SetWriteBlocked(bool status);
+		bool				PopLine(std::string& line);
+		bool				HasPendingLine() const;
+
+		bool				CanProcessLine(unsigned long long now_ms) const;
+		unsigned long long	FloodWaitMs(unsigned long long now_ms) const;
+		void				AddFloodPenalty(unsigned long long now_ms, unsigned int penalty_ms);
+		bool				IsFloodExempt() const;
+		void				SetFloodExempt(bool exempt);
+		bool				IsScheduled() const;
+		void				SetScheduled(bool status);
+		bool				MarkFanout(unsigned long long generation);
+		unsigned long long	GetId() const;
+		const std::string&	GetPrefix() const;
+		const struct sockaddr_in&	GetAddress() const;
+		void				SetAddress(const struct sockaddr_in& address);
+		TlsConnection*		GetTls() const;
+		void				SetTls(TlsConnection* tls);
 
 		void				SetNick(const std::string& name);
         void    			SetName(const std::string &name);
@@ -76,6 +142,8 @@ class Client : public AddressDataClient, public ClientInfo
         void    			SetRealname(const std::string &realname);
 
         const std::string&	getNick() const;
+        const IString&		getInternedNick() const;
+        const IString&		getInternedHostname() const;
         const std::string&	getName() const;
         const std::string&	getHostname() const;
         const std::string&	getServername() const;
@@ -85,7 +153,7 @@ class Client : public AddressDataClient, public ClientInfo
 
 		bool				operator==(const Client& c);
         bool                operator==(int c);
-		bool				operator==(const std::string& s);
+		bool				operator==(const IString& nick);
 		bool				operator!=(const Client& c);
 };
 
@@ -0,0 +1,71 @@
+#include "CloneTable.hpp"
+
+CloneTable::CloneTable() : _per_host(0), _per_subnet(0)
+{}
+
+void	CloneTable::SetLimits(long per_host, long per_subnet)
+{
+	this->_per_host = per_host;
+	this->_per_subnet = per_subnet;
+}
+
+/*
+ - Counts the connection and returns true, or returns false without counting it
+   when its address or subnet is already at the limit.
+*/
+bool	CloneTable::Admit(const struct sockaddr* addr)
+{
+	IpKey			key;
+	IpKey			subnet;
+	unsigned int*	host_count;
+	unsigned int*	subnet_count;
+
+	if (!_key(addr, key))
+		return true;
+	subnet = _subnet(key);
+	host_count = _hosts.Find(key);
+	subnet_count = _subnets.Find(subnet);
+	if (this->_per_host > 0 && host_count && *host_count >= (unsigned long)this->_per_host)
+		return false;
+	if (this->_per_subnet > 0 && subnet_count && *subnet_count >= (unsigned long)this->_per_subnet)
+		return false;
+	++_hosts[key];
+	++_subnets[subnet];
+	return true;
+}
+
+void	CloneTable::Release(const struct sockaddr* addr)
+{
+	IpKey	key;
+
+	if (!_key(addr, key))
+		return ;
+	_decrement(_hosts, key);
+	_decrement(_subnets, _subnet(key));
+}
+
+void	CloneTable::_decrement(HashMap<IpKey, unsigned int, IpKeyHash>& table, const IpKey& key)
+{
+	unsigned int*	count = table.Find(key);
+
+	if (!count)
+		return ;
+	if (--*count == 0)
+		table.Erase(key);
+}
+
+/*
+ - Fills key with the peer address, false for loopback and non IP peers (nothing to count).
+*/
+bool	CloneTable::_key(const struct sockaddr* addr, IpKey& key)
+{
+	return (IpKey::FromSockaddr(addr, key) && !key.IsLoopback());
+}
+
+IpKey	CloneTable::_subnet(const IpKey& key)
+{
+	IpKey	subnet = key;
+
+	subnet.Mask(key.IsV4() ? IPKEY_V4_OFFSET + CLONE_IPV4_SUBNET_BITS : CLONE_IPV6_SUBNET_BITS);
+	return (subnet);
+}
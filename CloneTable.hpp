@@ -0,0 +1,38 @@
+#ifndef CLONETABLE_HPP
+#define CLONETABLE_HPP
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "HashMap.hpp"
+#include "IpKey.hpp"
+
+#define CLONE_IPV4_SUBNET_BITS 24
+#define CLONE_IPV6_SUBNET_BITS 64
+
+/*
+ - Live connection count per address and per subnet (/24 for IPv4, /64 for IPv6).
+ - Admit() is called right after accept(), before any Client exists for the socket, and
+   every admitted connection is given back with Release() when the client is deleted.
+ - Loopback peers are never counted.
+ - A limit <= 0 disables that check.
+*/
+class CloneTable {
+	public:
+		CloneTable();
+
+		void	SetLimits(long per_host, long per_subnet);
+		bool	Admit(const struct sockaddr* addr);
+		void	Release(const struct sockaddr* addr);
+
+	private:
+		HashMap<IpKey, unsigned int, IpKeyHash>	_hosts;
+		HashMap<IpKey, unsigned int, IpKeyHash>	_subnets;
+		long									_per_host;
+		long									_per_subnet;
+
+		static bool		_key(const struct sockaddr* addr, IpKey& key);
+		static IpKey	_subnet(const IpKey& key);
+		static void		_decrement(HashMap<IpKey, unsigned int, IpKeyHash>& table, const IpKey& key);
+};
+
+#endif // CLONETABLE_HPP
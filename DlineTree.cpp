@@ -0,0 +1,157 @@
+#include <fstream>
+#include <algorithm>
+#include <sstream>
+#include <signal.h>
+#include "DlineTree.hpp"
+
+volatile sig_atomic_t	g_dline_reload_requested = 0;
+
+void	_dline_reload_handler(int signal_number)
+{
+	(void)signal_number;
+	g_dline_reload_requested = 1;
+}
+
+DlineTree::Node::Node(const IpKey& prefix, size_t prefix_len) : prefix(prefix), prefix_len(prefix_len), banned(false)
+{
+	this->prefix.Mask(prefix_len);
+	child[0] = NULL;
+	child[1] = NULL;
+}
+
+DlineTree::DlineTree() : _root(NULL), _size(0)
+{}
+
+DlineTree::~DlineTree()
+{
+	_destroy(_root);
+}
+
+void	DlineTree::_destroy(Node* node)
+{
+	if (!node)
+		return ;
+	_destroy(node->child[0]);
+	_destroy(node->child[1]);
+	delete node;
+}
+
+/*
+ - Bans cidr ("10.0.0.0/8", "2001:db8::/32", a bare address is a single host),
+   false when it doesn't parse. Adding a range that's already banned replaces its reason.
+*/
+bool	DlineTree::Add(const std::string& cidr, const std::string& reason)
+{
+	IpKey	key;
+	size_t	len;
+	Node**	link = &_root;
+
+	if (!IpKey::FromCidr(cidr, key, len))
+		return false;
+	while (*link) {
+		Node*	node = *link;
+		size_t	common = IpKey::CommonPrefix(node->prefix, key, node->prefix_len < len ? node->prefix_len : len);
+
+		if (common < node->prefix_len) {
+			// the new prefix leaves this branch above node, split it where they part
+			Node*	split = new Node(key, common);
+
+			split->child[node->prefix.Bit(common)] = node;
+			*link = split;
+			if (common == len) {
+				split->banned = true;
+				split->reason = reason;
+			}
+			else {
+				Node*	leaf = new Node(key, len);
+
+				leaf->banned = true;
+				leaf->reason = reason;
+				split->child[key.Bit(common)] = leaf;
+			}
+			++_size;
+			return true;
+		}
+		if (node->prefix_len == len) {
+			if (!node->banned)
+				++_size;
+			node->banned = true;
+			node->reason = reason;
+			return true;
+		}
+		link = &node->child[key.Bit(node->prefix_len)];
+	}
+	*link = new Node(key, len);
+	(*link)->banned = true;
+	(*link)->reason = reason;
+	++_size;
+	return true;
+}
+
+/*
+ - Reason of a ban covering the address, NULL if there's none.
+*/
+const std::string*	DlineTree::Match(const IpKey& key) const
+{
+	const Node*	node = _root;
+
+	while (node) {
+		if (IpKey::CommonPrefix(node->prefix, key, node->prefix_len) < node->prefix_len)
+			return NULL;
+		if (node->banned)
+			return (&node->reason);
+		if (node->prefix_len == IPKEY_BITS)
+			return NULL;
+		node = node->child[key.Bit(node->prefix_len)];
+	}
+	return NULL;
+}
+
+const std::string*	DlineTree::Match(const struct sockaddr* addr) const
+{
+	IpKey	key;
+
+	if (!_root || !IpKey::FromSockaddr(addr, key))
+		return NULL;
+	return (Match(key));
+}
+
+size_t	DlineTree::Size() const
+{
+	return (this->_size);
+}
+
+/*
+ - Reads one ban per line: "<cidr> [reason]", blank lines and lines starting with '#' are skipped.
+ - Lines that don't parse are reported and skipped, false only when the file can't be read.
+*/
+bool	DlineTree::Load(const std::string& path, std::ostream& errors)
+{
+	std::ifstream	file(path.c_str());
+	std::string		line;
+	size_t			number = 0;
+
+	if (!file)
+		return false;
+	while (std::getline(file, line)) {
+		std::istringstream	fields(line);
+		std::string			cidr;
+		std::string			reason;
+
+		++number;
+		if (!(fields >> cidr) || cidr[0] == '#')
+			continue ;
+		std::getline(fields >> std::ws, reason);
+		if (reason.empty())
+			reason = "D-lined";
+		if (!Add(cidr, reason))
+			errors << path << ":" << number << ": invalid address range '" << cidr << "'" << std::endl;
+	}
+	return true;
+}
+
+void	DlineTree::Swap(DlineTree& other)
+{
+	std::swap(this->_root, other._root);
+	std::swap(this->_size, other._size);
+}
@@ -0,0 +1,52 @@
+#ifndef DLINETREE_HPP
+#define DLINETREE_HPP
+
+#include <iostream>
+#include <string>
+#include <signal.h>
+#include <sys/socket.h>
+#include "IpKey.hpp"
+
+extern volatile sig_atomic_t	g_dline_reload_requested;
+
+void	_dline_reload_handler(int signal_number);
+
+/*
+ - D-lines: banned IPv4/IPv6 ranges in a path compressed binary radix (Patricia) tree.
+ - Every node holds a masked prefix and its length, a node's children extend its prefix and
+   differ at bit `prefix_len`, nodes that aren't a ban only exist where two branches split.
+ - A lookup walks at most one node per prefix length, comparing whole bytes at a time.
+*/
+class DlineTree {
+	public:
+		DlineTree();
+		~DlineTree();
+
+		bool				Add(const std::string& cidr, const std::string& reason);
+		const std::string*	Match(const struct sockaddr* addr) const;
+		const std::string*	Match(const IpKey& key) const;
+		size_t				Size() const;
+		bool				Load(const std::string& path, std::ostream& errors);
+		void				Swap(DlineTree& other);
+
+	private:
+		struct Node {
+			IpKey			prefix;
+			size_t			prefix_len;
+			bool			banned;
+			std::string		reason;
+			Node*			child[2];
+
+			Node(const IpKey& prefix, size_t prefix_len);
+		};
+
+		Node*	_root;
+		size_t	_size;
+
+		DlineTree(const DlineTree& copy);
+		DlineTree&	operator=(const DlineTree& copy);
+
+		static void	_destroy(Node* node);
+};
+
+#endif // DLINETREE_HPP
@@ -0,0 +1,130 @@
+#ifndef HASHMAP_HPP
+#define HASHMAP_HPP
+
+#include <vector>
+#include <cstddef>
+
+#define HASHMAP_MIN_CAPACITY 16
+
+/*
+ - Open addressing hash table with linear probing, kept at most half full.
+ - Capacity is a power of two so the home slot is hash & mask, erasing shifts the
+   following entries back instead of leaving tombstones, so lookups never slow down
+   on a table that keeps seeing inserts and erases.
+ - Hash is a functor: size_t operator()(const K&) const, K needs operator==.
+ - Pointers returned by Find() are invalidated by the next insertion.
+*/
+template <typename K, typename V, typename Hash>
+class HashMap {
+	public:
+		HashMap() : _slots(HASHMAP_MIN_CAPACITY), _size(0) {}
+
+		V*			Find(const K& key)
+		{
+			size_t	index = _probe(key);
+
+			return (_slots[index].used ? &_slots[index].value : NULL);
+		}
+
+		const V*	Find(const K& key) const
+		{
+			size_t	index = _probe(key);
+
+			return (_slots[index].used ? &_slots[index].value : NULL);
+		}
+
+		/*
+		 - Inserts a default constructed value when the key is missing.
+		*/
+		V&			operator[](const K& key)
+		{
+			size_t	index = _probe(key);
+
+			if (_slots[index].used)
+				return (_slots[index].value);
+			if ((_size + 1) * 2 > _slots.size()) {
+				_grow();
+				index = _probe(key);
+			}
+			_slots[index].used = true;
+			_slots[index].key = key;
+			_slots[index].value = V();
+			++_size;
+			return (_slots[index].value);
+		}
+
+		bool		Erase(const K& key)
+		{
+			size_t	mask = _slots.size() - 1;
+			size_t	hole = _probe(key);
+			size_t	next = hole;
+
+			if (!_slots[hole].used)
+				return false;
+			while (true) {
+				next = (next + 1) & mask;
+				if (!_slots[next].used)
+					break ;
+				size_t	home = _hash(_slots[next].key) & mask;
+				// the entry can fill the hole unless its home lies cyclically in (hole, next]
+				if ((next > hole && (home <= hole || home > next))
+					|| (next < hole && home <= hole && home > next)) {
+					_slots[hole] = _slots[next];
+					hole = next;
+				}
+			}
+			_slots[hole] = Slot();
+			--_size;
+			return true;
+		}
+
+		size_t		Size() const
+		{
+			return (_size);
+		}
+
+		void		Clear()
+		{
+			_slots.assign(HASHMAP_MIN_CAPACITY, Slot());
+			_size = 0;
+		}
+
+	private:
+		struct Slot {
+			K		key;
+			V		value;
+			bool	used;
+
+			Slot() : key(), value(), used(false) {}
+		};
+
+		std::vector<Slot>	_slots;
+		size_t				_size;
+		Hash				_hash;
+
+		/*
+		 - Slot holding the key, or the empty slot where it would go.
+		*/
+		size_t		_probe(const K& key) const
+		{
+			size_t	mask = _slots.size() - 1;
+			size_t	index = _hash(key) & mask;
+
+			while (_slots[index].used && !(_slots[index].key == key))
+				index = (index + 1) & mask;
+			return (index);
+		}
+
+		void		_grow()
+		{
+			std::vector<Slot>	old(_slots.size() * 2);
+
+			old.swap(_slots);
+			_size = 0;
+			for (size_t i = 0; i < old.size(); i++)
+				if (old[i].used)
+					(*this)[old[i].key] = old[i].value;
+		}
+};
+
+#endif // HASHMAP_HPP
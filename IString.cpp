@@ -0,0 +1,198 @@
+#include <unistd.h>
+#include "IString.hpp"
+#include "Toolkit.hpp"
+
+IString::IString() : _record(_empty())
+{
+	++this->_record->refs;
+}
+
+IString::IString(const std::string& text) : _record(_intern(text))
+{}
+
+IString::IString(const IString& copy) : _record(copy._record)
+{
+	++this->_record->refs;
+}
+
+IString&	IString::operator=(const IString& copy)
+{
+	++copy._record->refs;
+	_release(this->_record);
+	this->_record = copy._record;
+	return (*this);
+}
+
+IString::~IString()
+{
+	_release(this->_record);
+}
+
+const std::string&	IString::get() const
+{
+	return (this->_record->text);
+}
+
+const std::string&	IString::getFolded() const
+{
+	return (this->_record->folded->text);
+}
+
+size_t	IString::getHash() const
+{
+	return (this->_record->hash);
+}
+
+bool	IString::SameFolded(const IString& other) const
+{
+	return (this->_record->folded == other._record->folded);
+}
+
+bool	IString::operator==(const IString& other) const
+{
+	return (this->_record == other._record);
+}
+
+bool	IString::operator!=(const IString& other) const
+{
+	return (this->_record != other._record);
+}
+
+/*
+ - Lookup without interning, for names that mostly aren't in the pool (PRIVMSG to a nick that
+   isn't on): found is set to the record of text's casefolded form. false when there's none,
+   which means no IString casefolds to it either, a record holds on to its folded form.
+*/
+bool	IString::FindFolded(const std::string& text, IString& found)
+{
+	Key		key;
+	Record*	record;
+
+	key.text = &text;
+	key.hash = _hash(text);
+	record = _lookup(key);
+	if (record)
+		record = record->folded;
+	else
+	{
+		std::string	folded = _casefold(text);
+
+		if (folded == text)
+			return false;
+		key.text = &folded;
+		key.hash = _hash(folded);
+		if ((record = _lookup(key)) == NULL)
+			return false;
+	}
+	++record->refs;
+	_release(found._record);
+	found._record = record;
+	return true;
+}
+
+size_t	IString::PoolSize()
+{
+	return (_pool().Size());
+}
+
+bool	IString::Key::operator==(const Key& other) const
+{
+	return (this->hash == other.hash && *this->text == *other.text);
+}
+
+size_t	IString::KeyHash::operator()(const Key& key) const
+{
+	return (key.hash);
+}
+
+// a local static, so Clients built during static initialization still find it constructed
+HashMap<IString::Key, IString::Record*, IString::KeyHash>&	IString::_pool()
+{
+	static HashMap<Key, Record*, KeyHash>	pool;
+
+	return (pool);
+}
+
+// per process, nicks are picked by clients and shouldn't be chosen to land in the same slots
+static unsigned long long	s_hash_seed = 0;
+
+size_t	IString::_hash(const std::string& text)
+{
+	unsigned long long	h;
+
+	if (!s_hash_seed)
+		s_hash_seed = _gettime_ns() ^ ((unsigned long long)getpid() << 32) ^ 0x2545F4914F6CDD1DULL;
+	h = s_hash_seed;
+	for (size_t i = 0; i < text.length(); i++)
+	{
+		h ^= (unsigned char)text[i];
+		h *= 0x100000001B3ULL;
+	}
+	h ^= h >> 32;
+	return ((size_t)h);
+}
+
+// keeps a reference of its own, default constructed IStrings never build or free a record
+IString::Record*	IString::_empty()
+{
+	static Record*	empty = _intern(std::string());
+
+	return (empty);
+}
+
+IString::Record*	IString::_lookup(const Key& key)
+{
+	Record**	found = _pool().Find(key);
+
+	return (found ? *found : NULL);
+}
+
+/*
+ - Returns the record for text with a reference taken for the caller. A new record keeps the
+   pool key pointing at its own text, and a reference on its folded form unless it's folded
+   already.
+*/
+IString::Record*	IString::_intern(const std::string& text)
+{
+	Key			key;
+	Record*		record;
+
+	key.text = &text;
+	key.hash = _hash(text);
+	if ((record = _lookup(key)) != NULL) {
+		++record->refs;
+		return (record);
+	}
+	record = new Record();
+	record->text = text;
+	record->hash = key.hash;
+	record->refs = 1;
+	record->folded = record;
+	key.text = &record->text;
+	_pool()[key] = record;
+
+	std::string	folded = _casefold(text);
+
+	if (folded != text)
+		record->folded = _intern(folded);
+	return (record);
+}
+
+void	IString::_release(Record* record)
+{
+	Key	key;
+
+	if (--record->refs)
+		return ;
+	key.text = &record->text;
+	key.hash = record->hash;
+	_pool().Erase(key);
+	if (record->folded != record)
+		_release(record->folded);
+	delete record;
+}
+
+size_t	IStringHash::operator()(const IString& str) const
+{
+	return (str.getHash());
+}
@@ -0,0 +1,66 @@
+#ifndef ISTRING_HPP
+#define ISTRING_HPP
+
+#include <string>
+#include <cstddef>
+#include "HashMap.hpp"
+
+/*
+ - An interned, immutable string for identity fields (nick, username, hostname, servername,
+   realname): equal texts share one pooled record holding the text, its hash and a link to the
+   record of its casefolded form (see _casefold()), so thousands of clients from the same host
+   keep one copy and two IStrings compare by pointer, exactly with == or casefolded with
+   SameFolded().
+ - Records are refcounted and leave the pool with their last IString. The pool is process wide,
+   the server is single threaded.
+*/
+class IString {
+	public:
+		IString();
+		explicit IString(const std::string& text);
+		IString(const IString& copy);
+		IString&	operator=(const IString& copy);
+		~IString();
+
+		const std::string&	get() const;
+		const std::string&	getFolded() const;
+		size_t				getHash() const;
+		bool				SameFolded(const IString& other) const;
+		bool				operator==(const IString& other) const;
+		bool				operator!=(const IString& other) const;
+
+		static bool			FindFolded(const std::string& text, IString& found);
+		static size_t		PoolSize();
+
+	private:
+		struct Record {
+			std::string	text;
+			size_t		hash;
+			size_t		refs;
+			Record*		folded; // itself when text is already folded, otherwise holds a reference
+		};
+		struct Key {
+			const std::string*	text;
+			size_t				hash;
+
+			bool	operator==(const Key& other) const;
+		};
+		struct KeyHash {
+			size_t	operator()(const Key& key) const;
+		};
+
+		Record*	_record;
+
+		static HashMap<Key, Record*, KeyHash>&	_pool();
+		static Record*	_empty();
+		static Record*	_lookup(const Key& key);
+		static Record*	_intern(const std::string& text);
+		static void		_release(Record* record);
+		static size_t	_hash(const std::string& text);
+};
+
+struct IStringHash {
+	size_t	operator()(const IString& str) const;
+};
+
+#endif // ISTRING_HPP
@@ -0,0 +1,149 @@
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include "IpKey.hpp"
+#include "Toolkit.hpp"
+
+static const unsigned char	v4_prefix[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+
+IpKey::IpKey()
+{
+	memset(bytes, 0, sizeof(bytes));
+}
+
+bool	IpKey::operator==(const IpKey& other) const
+{
+	return (memcmp(bytes, other.bytes, sizeof(bytes)) == 0);
+}
+
+/*
+ - Bit 0 is the most significant bit of the address.
+*/
+bool	IpKey::Bit(size_t index) const
+{
+	return ((bytes[index / 8] >> (7 - index % 8)) & 1);
+}
+
+bool	IpKey::IsV4() const
+{
+	return (memcmp(bytes, v4_prefix, sizeof(v4_prefix)) == 0);
+}
+
+bool	IpKey::IsLoopback() const
+{
+	static const unsigned char	v6_loopback[16] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 };
+
+	if (IsV4())
+		return (bytes[12] == 127);
+	return (memcmp(bytes, v6_loopback, sizeof(v6_loopback)) == 0);
+}
+
+/*
+ - Clears every bit past the first prefix_len.
+*/
+void	IpKey::Mask(size_t prefix_len)
+{
+	for (size_t i = 0; i < 16; i++)
+	{
+		if (prefix_len >= 8)
+			prefix_len -= 8;
+		else {
+			bytes[i] &= (unsigned char)(0xff << (8 - prefix_len));
+			prefix_len = 0;
+		}
+	}
+}
+
+/*
+ - False for peers that aren't IPv4 or IPv6 (unix sockets).
+*/
+bool	IpKey::FromSockaddr(const struct sockaddr* addr, IpKey& key)
+{
+	key = IpKey();
+	if (addr->sa_family == AF_INET) {
+		memcpy(key.bytes, v4_prefix, sizeof(v4_prefix));
+		memcpy(key.bytes + 12, &((const struct sockaddr_in*)addr)->sin_addr, 4);
+		return true;
+	}
+	if (addr->sa_family == AF_INET6) {
+		memcpy(key.bytes, &((const struct sockaddr_in6*)addr)->sin6_addr, 16);
+		return true;
+	}
+	return false;
+}
+
+/*
+ - Parses "a.b.c.d[/n]" or "ipv6[/n]", a missing prefix length means a single address.
+ - The key comes back masked to the prefix, prefix_len is in IPv6 bits.
+*/
+bool	IpKey::FromCidr(const std::string& text, IpKey& key, size_t& prefix_len)
+{
+	std::string::size_type	slash = text.find('/');
+	std::string				address = text.substr(0, slash);
+	bool					v4 = (address.find(':') == std::string::npos);
+	size_t					max_len = (v4 ? 32 : IPKEY_BITS);
+	char*					end;
+
+	key = IpKey();
+	prefix_len = max_len;
+	if (slash != std::string::npos) {
+		std::string	len = text.substr(slash + 1);
+		long		value = strtol(len.c_str(), &end, 10);
+
+		if (len.empty() || *end || value < 0 || (size_t)value > max_len)
+			return false;
+		prefix_len = value;
+	}
+	if (v4) {
+		memcpy(key.bytes, v4_prefix, sizeof(v4_prefix));
+		if (inet_pton(AF_INET, address.c_str(), key.bytes + 12) != 1)
+			return false;
+		prefix_len += IPKEY_V4_OFFSET;
+	}
+	else if (inet_pton(AF_INET6, address.c_str(), key.bytes) != 1)
+		return false;
+	key.Mask(prefix_len);
+	return true;
+}
+
+/*
+ - Number of leading bits a and b share, at most max_len.
+*/
+size_t	IpKey::CommonPrefix(const IpKey& a, const IpKey& b, size_t max_len)
+{
+	size_t	len = 0;
+
+	for (size_t i = 0; i < 16 && len < max_len; i++)
+	{
+		unsigned char	diff = a.bytes[i] ^ b.bytes[i];
+
+		if (diff) {
+			len += __builtin_clz((unsigned int)diff) - 24;
+			break ;
+		}
+		len += 8;
+	}
+	return (len < max_len ? len : max_len);
+}
+
+// per process, so nobody can pick addresses that land in the same slots ahead of time
+static unsigned long long	s_hash_seed = 0;
+
+size_t	IpKeyHash::operator()(const IpKey& key) const
+{
+	unsigned long long	words[2];
+	unsigned long long	h;
+
+	if (!s_hash_seed)
+		s_hash_seed = _gettime_ns() ^ ((unsigned long long)getpid() << 32) ^ 0x2545F4914F6CDD1DULL;
+	h = s_hash_seed;
+	memcpy(words, key.bytes, sizeof(words));
+	for (size_t i = 0; i < 2; i++)
+	{
+		h ^= words[i];
+		h *= 0x9E3779B97F4A7C15ULL;
+		h ^= h >> 32;
+	}
+	return ((size_t)h);
+}
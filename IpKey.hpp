@@ -0,0 +1,35 @@
+#ifndef IPKEY_HPP
+#define IPKEY_HPP
+
+#include <string>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define IPKEY_BITS 128
+#define IPKEY_V4_OFFSET 96
+
+/*
+ - IPv6 address, IPv4 peers are stored IPv4-mapped (::ffff:a.b.c.d) so both families share
+   one key type, an IPv4 /n is the IPv6 /(96 + n).
+*/
+struct IpKey {
+	unsigned char	bytes[16];
+
+	IpKey();
+	bool	operator==(const IpKey& other) const;
+
+	bool	Bit(size_t index) const;
+	bool	IsV4() const;
+	bool	IsLoopback() const;
+	void	Mask(size_t prefix_len);
+
+	static bool		FromSockaddr(const struct sockaddr* addr, IpKey& key);
+	static bool		FromCidr(const std::string& text, IpKey& key, size_t& prefix_len);
+	static size_t	CommonPrefix(const IpKey& a, const IpKey& b, size_t max_len);
+};
+
+struct IpKeyHash {
+	size_t	operator()(const IpKey& key) const;
+};
+
+#endif // IPKEY_HPP
@@ -0,0 +1,110 @@
+#include <cstring>
+#include "Mask.hpp"
+#include "Toolkit.hpp"
+
+Mask::Mask() : _star(false), _min_length(0)
+{
+	this->_segments.push_back(std::string());
+}
+
+Mask::Mask(const std::string& mask) : _mask(_casefold(mask)), _star(false), _min_length(0)
+{
+	size_t	start = 0;
+	size_t	star;
+	size_t	wildcard;
+
+	while ((star = this->_mask.find('*', start)) != std::string::npos) {
+		if (star > start || this->_segments.empty())
+			this->_segments.push_back(this->_mask.substr(start, star - start));
+		this->_star = true;
+		start = star + 1;
+	}
+	this->_segments.push_back(this->_mask.substr(start));
+	for (size_t i = 0; i < this->_segments.size(); i++)
+		this->_min_length += this->_segments[i].length();
+	wildcard = this->_mask.find_first_of("*?");
+	this->_head = this->_mask.substr(0, wildcard);
+	wildcard = this->_mask.find_last_of("*?");
+	this->_tail = (wildcard == std::string::npos ? this->_mask : this->_mask.substr(wildcard + 1));
+}
+
+const std::string&	Mask::getMask() const
+{
+	return (this->_mask);
+}
+
+const std::string&	Mask::getHead() const
+{
+	return (this->_head);
+}
+
+const std::string&	Mask::getTail() const
+{
+	return (this->_tail);
+}
+
+/*
+ - segment matches the text starting at at, which holds at least segment.length() characters.
+*/
+bool	Mask::_segment_at(const std::string& segment, const char* at)
+{
+	for (size_t i = 0; i < segment.length(); i++)
+		if (segment[i] != at[i] && segment[i] != '?')
+			return false;
+	return true;
+}
+
+/*
+ - Leftmost place in [from, end) where segment matches, NULL if there's none. Segments starting
+   with a literal character jump between its occurrences with memchr(), which libc scans a
+   vector register at a time.
+*/
+const char*	Mask::_search(const std::string& segment, const char* from, const char* end)
+{
+	const char*	last = end - segment.length();
+
+	if (from > last)
+		return (NULL);
+	if (segment[0] == '?') {
+		for (; from <= last; from++)
+			if (_segment_at(segment, from))
+				return (from);
+		return (NULL);
+	}
+	while (from <= last && (from = (const char*)std::memchr(from, segment[0], last - from + 1)) != NULL) {
+		if (_segment_at(segment, from))
+			return (from);
+		++from;
+	}
+	return (NULL);
+}
+
+/*
+ - The head segment is matched at the start and the tail one at the end, with '*' any
+   segments in between only have to appear in order: taking the leftmost place for each
+   never loses a match.
+*/
+bool	Mask::Match(const std::string& folded) const
+{
+	const char*	from = folded.data();
+	const char*	end = from + folded.length();
+
+	if (!this->_star)
+		return (folded.length() == this->_min_length && _segment_at(this->_segments[0], from));
+	if (folded.length() < this->_min_length)
+		return false;
+	const std::string&	head = this->_segments.front();
+	const std::string&	tail = this->_segments.back();
+	if (!_segment_at(head, from) || !_segment_at(tail, end - tail.length()))
+		return false;
+	from += head.length();
+	end -= tail.length();
+	for (size_t i = 1; i + 1 < this->_segments.size(); i++) {
+		const char*	found = _search(this->_segments[i], from, end);
+
+		if (!found)
+			return false;
+		from = found + this->_segments[i].length();
+	}
+	return true;
+}
@@ -0,0 +1,38 @@
+#ifndef MASK_HPP
+#define MASK_HPP
+
+#include <string>
+#include <vector>
+
+/*
+ - A glob mask ('*' any run of characters, '?' exactly one) compiled once and matched many
+   times: bans and invite exceptions on every JOIN, WHO masks against every candidate.
+ - The mask is casefolded (see _casefold()) and split on '*' into literal segments: the first
+   has to start the subject, the last has to end it, both are checked in place before the
+   ones in between are searched for left to right.
+ - Match() expects a subject that's casefolded already, callers fold a nick!user@host once
+   and test it against a whole list.
+*/
+class Mask {
+	public:
+		Mask();
+		explicit Mask(const std::string& mask);
+
+		bool				Match(const std::string& folded) const;
+		const std::string&	getMask() const;
+		const std::string&	getHead() const;
+		const std::string&	getTail() const;
+
+	private:
+		std::string					_mask; // folded
+		std::vector<std::string>	_segments;
+		bool						_star; // false: the mask is one segment matching the whole subject
+		size_t						_min_length;
+		std::string					_head; // literal text before the first wildcard
+		std::string					_tail; // literal text after the last wildcard
+
+		static bool			_segment_at(const std::string& segment, const char* at);
+		static const char*	_search(const std::string& segment, const char* from, const char* end);
+};
+
+#endif // MASK_HPP
@@ -0,0 +1,197 @@
+#include <iomanip>
+#include "Metrics.hpp"
+
+static const char*	disconnect_reasons[DISCONNECT_REASON_COUNT] = {
+	"quit", "hangup", "bad_password", "timeout", "kicked", "excess_flood", "dlined"
+};
+
+static const char*	refused_reasons[REFUSED_REASON_COUNT] = {
+	"dline", "clones"
+};
+
+volatile sig_atomic_t	g_metrics_dump_requested = 0;
+
+Histogram::Histogram() : _count(0), _sum(0), _max(0)
+{
+	for (size_t i = 0; i < METRICS_HISTOGRAM_BUCKETS; i++)
+		_buckets[i] = 0;
+}
+
+/*
+ - Values below 2 * METRICS_SUB_BUCKETS get a bucket each, above that the magnitude
+   picks the row and the next METRICS_SUB_BUCKET_BITS bits pick the column.
+*/
+size_t	Histogram::_index(unsigned long long value)
+{
+	size_t	magnitude;
+
+	if (value < 2 * METRICS_SUB_BUCKETS)
+		return (value);
+	magnitude = 63 - __builtin_clzll(value);
+	if (magnitude > METRICS_MAX_MAGNITUDE)
+		return (METRICS_HISTOGRAM_BUCKETS - 1);
+	return ((magnitude - METRICS_SUB_BUCKET_BITS) * METRICS_SUB_BUCKETS + (value >> (magnitude - METRICS_SUB_BUCKET_BITS)));
+}
+
+/*
+ - Largest value that lands in the bucket.
+*/
+unsigned long long	Histogram::_upper(size_t index)
+{
+	size_t	shift;
+
+	if (index < 2 * METRICS_SUB_BUCKETS)
+		return (index);
+	shift = index / METRICS_SUB_BUCKETS - 1;
+	return ((((unsigned long long)(index % METRICS_SUB_BUCKETS + METRICS_SUB_BUCKETS) + 1) << shift) - 1);
+}
+
+void	Histogram::Observe(unsigned long long value)
+{
+	++_buckets[_index(value)];
+	++_count;
+	_sum += value;
+	if (value > _max)
+		_max = value;
+}
+
+unsigned long long	Histogram::getCount() const
+{
+	return (this->_count);
+}
+
+unsigned long long	Histogram::getMax() const
+{
+	return (this->_max);
+}
+
+/*
+ - Upper bound of the bucket holding the q-th quantile (0 < q <= 1),
+   capped by the largest value recorded.
+*/
+unsigned long long	Histogram::Percentile(double q) const
+{
+	unsigned long long	rank = (unsigned long long)(q * _count + 0.5);
+	unsigned long long	cumulative = 0;
+
+	if (rank == 0)
+		rank = 1;
+	for (size_t i = 0; i < METRICS_HISTOGRAM_BUCKETS; i++)
+	{
+		cumulative += _buckets[i];
+		if (cumulative >= rank)
+			return (_upper(i) < _max ? _upper(i) : _max);
+	}
+	return (_max);
+}
+
+/*
+ - Writes the histogram as cumulative Prometheus buckets ending below every power of two,
+   scale converts the recorded unit into the exported one (ns -> seconds for example).
+ - le is inclusive: a bucket row covers values up to 2^m - 1, the exact upper edge of the
+   histogram buckets it sums (a power of two starts a new bucket), and le says so.
+ - labels is either empty or a comma terminated label list ("command=\"JOIN\",").
+*/
+void	Histogram::Render(std::ostream& os, const std::string& name, const std::string& labels, double scale) const
+{
+	unsigned long long	cumulative = 0;
+	size_t				index = 0;
+	std::streamsize		precision = os.precision(15); // the default 6 digits would round large edges down
+
+	for (size_t magnitude = 0; magnitude <= METRICS_MAX_MAGNITUDE; magnitude++)
+	{
+		for (; index < METRICS_HISTOGRAM_BUCKETS - 1 && _upper(index) < (1ULL << magnitude); index++)
+			cumulative += _buckets[index];
+		os << name << "_bucket{" << labels << "le=\"" << (double)((1ULL << magnitude) - 1) * scale << "\"} " << cumulative << "\n";
+	}
+	os.precision(precision);
+	os << name << "_bucket{" << labels << "le=\"+Inf\"} " << _count << "\n";
+	os << name << "_sum";
+	if (!labels.empty())
+		os << "{" << labels.substr(0, labels.length() - 1) << "}";
+	os << " " << (double)_sum * scale << "\n";
+	os << name << "_count";
+	if (!labels.empty())
+		os << "{" << labels.substr(0, labels.length() - 1) << "}";
+	os << " " << _count << "\n";
+}
+
+ScopedTimer::ScopedTimer(Histogram& histogram) : _histogram(histogram), _start(_gettime_ns())
+{}
+
+ScopedTimer::~ScopedTimer()
+{
+	_histogram.Observe(_gettime_ns() - _start);
+}
+
+void	_metrics_dump_handler(int signal_number)
+{
+	(void)signal_number;
+	g_metrics_dump_requested = 1;
+}
+
+Metrics::Metrics() : bytes_in(0), bytes_out(0), messages_in(0), messages_out(0), accepted(0), sendq_shed(0)
+{
+	for (size_t i = 0; i < METRICS_MAX_COMMANDS; i++)
+		commands[i] = 0;
+	for (size_t i = 0; i < DISCONNECT_REASON_COUNT; i++)
+		disconnects[i] = 0;
+	for (size_t i = 0; i < REFUSED_REASON_COUNT; i++)
+		refused[i] = 0;
+}
+
+void	_metrics_header(std::ostream& os, const std::string& name, const std::string& type, const std::string& help)
+{
+	os << "# HELP " << name << " " << help << "\n";
+	os << "# TYPE " << name << " " << type << "\n";
+}
+
+void	Metrics::Render(std::ostream& os, const char* const* command_names, size_t command_count) const
+{
+	_metrics_header(os, "ircserv_received_bytes_total", "counter", "Bytes read from client sockets.");
+	os << "ircserv_received_bytes_total " << bytes_in << "\n";
+	_metrics_header(os, "ircserv_sent_bytes_total", "counter", "Bytes written to client sockets.");
+	os << "ircserv_sent_bytes_total " << bytes_out << "\n";
+	_metrics_header(os, "ircserv_received_messages_total", "counter", "IRC lines received from clients.");
+	os << "ircserv_received_messages_total " << messages_in << "\n";
+	_metrics_header(os, "ircserv_sent_messages_total", "counter", "IRC lines sent to clients.");
+	os << "ircserv_sent_messages_total " << messages_out << "\n";
+	_metrics_header(os, "ircserv_accepted_connections_total", "counter", "Connections accepted on the listening socket.");
+	os << "ircserv_accepted_connections_total " << accepted << "\n";
+	_metrics_header(os, "ircserv_refused_connections_total", "counter", "Connections closed right after accept, by reason.");
+	for (size_t i = 0; i < REFUSED_REASON_COUNT; i++)
+		os << "ircserv_refused_connections_total{reason=\"" << refused_reasons[i] << "\"} " << refused[i] << "\n";
+	_metrics_header(os, "ircserv_commands_total", "counter", "Commands dispatched, by command.");
+	for (size_t i = 0; i < command_count && i < METRICS_MAX_COMMANDS; i++)
+		os << "ircserv_commands_total{command=\"" << command_names[i] << "\"} " << commands[i] << "\n";
+	_metrics_header(os, "ircserv_disconnects_total", "counter", "Client disconnections, by reason.");
+	for (size_t i = 0; i < DISCONNECT_REASON_COUNT; i++)
+		os << "ircserv_disconnects_total{reason=\"" << disconnect_reasons[i] << "\"} " << disconnects[i] << "\n";
+	_metrics_header(os, "ircserv_loop_iteration_seconds", "histogram", "Time spent handling the events of one event loop iteration.");
+	loop_iteration_ns.Render(os, "ircserv_loop_iteration_seconds", "", 1e-9);
+	_metrics_header(os, "ircserv_command_duration_seconds", "histogram", "Time spent in each command handler.");
+	for (size_t i = 0; i < command_count && i < METRICS_MAX_COMMANDS; i++)
+		command_latency_ns[i].Render(os, "ircserv_command_duration_seconds", std::string("command=\"") + command_names[i] + "\",", 1e-9);
+}
+
+/*
+ - Human readable per-command latency table, written on SIGUSR1.
+*/
+void	Metrics::DumpLatencies(std::ostream& os, const char* const* command_names, size_t command_count) const
+{
+	const double	quantiles[4] = { 0.5, 0.9, 0.99, 0.999 };
+
+	os << "command        count      p50(us)    p90(us)    p99(us)  p99.9(us)    max(us)" << std::endl;
+	for (size_t i = 0; i < command_count && i < METRICS_MAX_COMMANDS; i++)
+	{
+		const Histogram& h = command_latency_ns[i];
+
+		os << command_names[i];
+		for (size_t pad = std::string(command_names[i]).length(); pad < 10; pad++)
+			os << " ";
+		os << " " << std::setw(9) << h.getCount();
+		for (size_t q = 0; q < 4; q++)
+			os << " " << std::setw(10) << std::fixed << std::setprecision(1) << (h.getCount() ? h.Percentile(quantiles[q]) / 1000.0 : 0.0);
+		os << " " << std::setw(10) << h.getMax() / 1000.0 << std::endl;
+	}
+}
@@ -0,0 +1,101 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <iostream>
+#include <string>
+#include <signal.h>
+#include "Toolkit.hpp"
+
+#define METRICS_SUB_BUCKET_BITS 3
+#define METRICS_SUB_BUCKETS (1 << METRICS_SUB_BUCKET_BITS)
+#define METRICS_MAX_MAGNITUDE 40
+#define METRICS_HISTOGRAM_BUCKETS ((METRICS_MAX_MAGNITUDE - METRICS_SUB_BUCKET_BITS + 1) * METRICS_SUB_BUCKETS + METRICS_SUB_BUCKETS)
+#define METRICS_MAX_COMMANDS 16
+
+extern volatile sig_atomic_t	g_metrics_dump_requested;
+
+enum DisconnectReason {
+	DISCONNECT_QUIT,
+	DISCONNECT_HANGUP,
+	DISCONNECT_BAD_PASSWORD,
+	DISCONNECT_TIMEOUT,
+	DISCONNECT_KICKED,
+	DISCONNECT_EXCESS_FLOOD,
+	DISCONNECT_DLINED,
+	DISCONNECT_REASON_COUNT
+};
+
+enum RefusedReason {
+	REFUSED_DLINE,
+	REFUSED_CLONES,
+	REFUSED_REASON_COUNT
+};
+
+/*
+ - Log-linear (HDR style) histogram: every power of two is split into METRICS_SUB_BUCKETS
+   equal buckets, so any recorded value is known within 1/METRICS_SUB_BUCKETS of itself.
+ - Fixed memory, observing is a bit scan, a shift and a few additions.
+ - Values above 2^METRICS_MAX_MAGNITUDE land in the last bucket.
+*/
+class Histogram {
+	public:
+		Histogram();
+
+		void				Observe(unsigned long long value);
+		unsigned long long	getCount() const;
+		unsigned long long	getMax() const;
+		unsigned long long	Percentile(double q) const;
+		void				Render(std::ostream& os, const std::string& name, const std::string& labels, double scale) const;
+
+	private:
+		unsigned long long	_buckets[METRICS_HISTOGRAM_BUCKETS];
+		unsigned long long	_count;
+		unsigned long long	_sum;
+		unsigned long long	_max;
+
+		static size_t				_index(unsigned long long value);
+		static unsigned long long	_upper(size_t index);
+};
+
+/*
+ - Records the time spent between its construction and destruction,
+   also when the scope is left by an exception (QUIT).
+*/
+class ScopedTimer {
+	public:
+		ScopedTimer(Histogram& histogram);
+		~ScopedTimer();
+
+	private:
+		Histogram&			_histogram;
+		unsigned long long	_start;
+};
+
+/*
+ - Counters owned by the event loop thread, they are plain integers bumped in place
+   and only read when a scrape renders them, so the hot path never takes a lock.
+*/
+struct Metrics {
+	unsigned long long	bytes_in;
+	unsigned long long	bytes_out;
+	unsigned long long	messages_in;
+	unsigned long long	messages_out;
+	unsigned long long	accepted;
+	unsigned long long	sendq_shed; // from clients already gone, live ones are summed when rendering
+	unsigned long long	refused[REFUSED_REASON_COUNT];
+	unsigned long long	commands[METRICS_MAX_COMMANDS];
+	unsigned long long	disconnects[DISCONNECT_REASON_COUNT];
+	Histogram			loop_iteration_ns;
+	Histogram			command_latency_ns[METRICS_MAX_COMMANDS];
+
+	Metrics();
+
+	void	Render(std::ostream& os, const char* const* command_names, size_t command_count) const;
+	void	DumpLatencies(std::ostream& os, const char* const* command_names, size_t command_count) const;
+};
+
+void	_metrics_dump_handler(int signal_number);
+
+void	_metrics_header(std::ostream& os, const std::string& name, const std::string& type, const std::string& help);
+
+#endif // METRICS_HPP
@@ -14,8 +14,30 @@
 #include "Toolkit.hpp"
 #include "Client.hpp"
 #include "Parse.hpp"
+#include "Watchdog.hpp"
+
+/*
+ - Dispatch table: command name, handler and flood penalty in ms (see Client::CanProcessLine).
+*/
+const t_command	Server::_commands[] = {
+	{ "NICK", &Server::nick, 2000 },
+	{ "JOIN", &Server::join, 1000 },
+	{ "WHO", &Server::who, 2000 },
+	{ "NAMES", &Server::names, 2000 },
+	{ "MODE", &Server::mode, 1000 },
+	{ "PRIVMSG", &Server::privMsg, FLOOD_MESSAGE_PENALTY_MS },
+	{ "NOTICE", &Server::notice, FLOOD_MESSAGE_PENALTY_MS },
+	{ "TOPIC", &Server::topic, 1000 },
+	{ "INVITE", &Server::invite, 2000 },
+	{ "KICK", &Server::kick, 1000 },
+	{ "USER", &Server::user, 1000 },
+	{ "QUIT", &Server::quit, 0 },
+	{ "PING", &Server::ping, 500 }
+};
+const size_t	Server::_command_count = sizeof(Server::_commands) / sizeof(Server::_commands[0]);
+
 /* === Coplien's form ===*/
-Server::Server() : client_count(0)
+Server::Server() : client_count(0), ready_wait_ms(-1), busy_poll_us(0), spin_budget_ns(0), last_event_ns(0), fanout_generation(0), last_invite_reap(0), tls_socket_fd(-1), unix_socket_fd(-1), metrics_socket_fd(-1)
 {
 	_bzero(&this->hints, sizeof(this->hints));
 	this->server_socket_fd = -1;
@@ -26,7 +48,7 @@ Server::Server() : client_count(0)
 }
 
 
-Server::Server(const Server& copy)
+Server::Server(const Server& copy) : ready_wait_ms(-1), busy_poll_us(0), spin_budget_ns(0), last_event_ns(0), fanout_generation(0), last_invite_reap(0), tls_socket_fd(-1), unix_socket_fd(-1), metrics_socket_fd(-1)
 {
 	(void) copy;
 	_memset(&this->hints, (char *)&copy.hints, sizeof(copy.hints));
@@ -39,7 +61,8 @@ Server::Server(const Server& copy)
 
 Server::Server(std::string port, std::string pass) {
 	Server();
-	CreateServer(port, pass);
+	if (!CreateServer(port, pass))
+		OnServerLoop();
 	this->_setChannels();
 }
 
@@ -104,6 +127,7 @@ bool	Server::CreateServer(const std::string &port, const std::string &pass) {
 		return 1;
 
     signal(SIGPIPE, SIG_IGN);
+    signal(SIGUSR1, _metrics_dump_handler);
 	this->server_socket_fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
 	if (this->server_socket_fd == -1) {
 		std::cerr << "Error: Socket creation has failed!" << std::endl;
@@ -121,10 +145,186 @@ bool	Server::CreateServer(const std::string &port, const std::string &pass) {
 	std::cout << "Server has been successfully created for port " + port << std::endl;
 	fcntl(server_socket_fd, F_SETFL, O_NONBLOCK);
 	InsertSocketFileDescriptorToPollQueue(server_socket_fd);
-	OnServerLoop();
+	if (CreateMetricsListener(_getenv_num("IRCSERV_METRICS_PORT", 0)))
+		return 1;
+	if (CreateTlsListener())
+		return 1;
+	if (CreateUnixListener())
+		return 1;
+	if (SetLowLatencyMode(_getenv_num("IRCSERV_CPU", -1), _getenv_num("IRCSERV_BUSY_POLL_US", 0), _getenv_num("IRCSERV_SPIN_US", 0)))
+		return 1;
+	this->_clones.SetLimits(_getenv_num("IRCSERV_CLONES_PER_HOST", MAX_SAME_CLIENT_CONNECTIONS),
+		_getenv_num("IRCSERV_CLONES_PER_SUBNET", MAX_SAME_SUBNET_CONNECTIONS));
+	if (std::getenv("IRCSERV_DLINE_FILE")) {
+		this->dline_path = std::getenv("IRCSERV_DLINE_FILE");
+		ReloadDlines();
+		signal(SIGHUP, _dline_reload_handler);
+	}
+	if (Watchdog::Start(_getenv_num("IRCSERV_STALL_MS", 0))) {
+		std::cerr << "Error: Couldn't arm the event loop watchdog!" << std::endl;
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ - Creates an extra non-blocking listening socket on the given address and registers it into the poll queue.
+ - Returns the listening fd or -1 on failure.
+*/
+int		Server::CreateListener(const struct sockaddr *addr, socklen_t addr_len) {
+	int optval = 1;
+	int fd = socket(addr->sa_family, SOCK_STREAM, 0);
+
+	if (fd == -1)
+		return -1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR,  &optval, sizeof(optval));
+	if (bind(fd, addr, addr_len) == -1 || listen(fd, MAX_IRC_CONNECTIONS) == -1) {
+		close(fd);
+		return -1;
+	}
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	InsertSocketFileDescriptorToPollQueue(fd);
+	return fd;
+}
+
+/*
+ - Opt-in (IRCSERV_TLS_CERT) second listener for TLS clients on IRCSERV_TLS_PORT (6697 by default).
+ - IRCSERV_TLS_KEY is the private key, the certificate file itself when unset,
+   IRCSERV_TLS_KTLS=1 asks OpenSSL to hand record encryption to the kernel.
+*/
+bool	Server::CreateTlsListener(void) {
+	const char*			cert = std::getenv("IRCSERV_TLS_CERT");
+	const char*			key = std::getenv("IRCSERV_TLS_KEY");
+	long				port = _getenv_num("IRCSERV_TLS_PORT", TLS_DEFAULT_PORT);
+	struct sockaddr_in	addr;
+
+	if (!cert || !*cert)
+		return 0;
+	if (port <= 0 || port > 65535) {
+		std::cerr << "Error: Invalid TLS port number!" << std::endl;
+		return 1;
+	}
+	if (!this->_tls.Init(cert, (key && *key) ? key : cert, _getenv_num("IRCSERV_TLS_KTLS", 0) > 0))
+		return 1;
+	_bzero(&addr, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	this->tls_socket_fd = CreateListener((struct sockaddr *)&addr, sizeof(addr));
+	if (this->tls_socket_fd == -1) {
+		std::cerr << "Error: Couldn't create the TLS listener on port " << port << "!" << std::endl;
+		return 1;
+	}
+	std::cout << "TLS connections are accepted on port " << port << std::endl;
+	return 0;
+}
+
+/*
+ - Opt-in (IRCSERV_UNIX_SOCKET) AF_UNIX listener for bots and services running on the same host,
+   they go through the same client path as TCP connections without the TCP stack.
+ - A stale socket file left by an earlier run is replaced, any other file at the path is an error.
+   The socket is created 0660, who may connect is up to its directory and group.
+*/
+bool	Server::CreateUnixListener(void) {
+	const char*			path = std::getenv("IRCSERV_UNIX_SOCKET");
+	struct sockaddr_un	addr;
+	struct stat			st;
+
+	if (!path || !*path)
+		return 0;
+	if (std::strlen(path) >= sizeof(addr.sun_path)) {
+		std::cerr << "Error: Unix socket path is too long: " << path << std::endl;
+		return 1;
+	}
+	if (lstat(path, &st) == 0) {
+		if (!S_ISSOCK(st.st_mode)) {
+			std::cerr << "Error: " << path << " exists and isn't a socket!" << std::endl;
+			return 1;
+		}
+		unlink(path);
+	}
+	_bzero(&addr, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	std::strcpy(addr.sun_path, path);
+	this->unix_socket_fd = CreateListener((struct sockaddr *)&addr, sizeof(addr));
+	if (this->unix_socket_fd == -1) {
+		std::cerr << "Error: Couldn't listen on " << path << ": " << std::strerror(errno) << std::endl;
+		return 1;
+	}
+	chmod(path, 0660);
+	this->unix_path = path;
+	std::cout << "Local connections are accepted on " << path << std::endl;
+	return 0;
+}
+
+/*
+ - SO_PEERCRED of a unix socket peer: trusted when it runs as the server's user or as root.
+*/
+bool	Server::IsTrustedPeer(int fd) const {
+	struct ucred	cred;
+	socklen_t		len = sizeof(cred);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1)
+		return false;
+	return (cred.uid == 0 || cred.uid == geteuid());
+}
+
+bool	Server::IsUnixPeer(int fd) const {
+	struct sockaddr_storage	addr;
+	socklen_t				len = sizeof(addr);
+
+	return (getsockname(fd, (struct sockaddr *)&addr, &len) == 0 && addr.ss_family == AF_UNIX);
+}
+
+bool	Server::IsListener(int fd) const {
+	return (fd >= 0 && (fd == this->server_socket_fd || fd == this->tls_socket_fd || fd == this->unix_socket_fd));
+}
+
+/*
+ - Sets up a server that has no listening socket at all, connections are only
+   added through AttachConnection() / ConnectLoopback().
+ - Used to embed the server in tests and benchmarks, where it's stepped with OnServerTick().
+*/
+bool	Server::CreateLoopbackServer(const std::string &pass) {
+	if (pass.empty()) {
+		std::cerr << "Error: Password cannot be empty!" << std::endl;
+		return 1;
+	}
+	this->password = pass;
+	signal(SIGPIPE, SIG_IGN);
 	return 0;
 }
 
+/*
+ - Registers an already connected stream fd as a new client, exactly like accept() would.
+ - Any fd that behaves like a stream socket works (socketpair, pipe-backed pty...),
+   the server only ever recv()s from it and send()s to it.
+*/
+int		Server::AttachConnection(int connection_fd) {
+	if (connection_fd < 0)
+		return -1;
+	_bzero(&this->client_sock_data, sizeof(this->client_sock_data));
+	this->client_sock_data.sin_family = AF_INET;
+	this->client_sock_data.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	InsertClient(connection_fd);
+	return connection_fd;
+}
+
+/*
+ - Creates an in-process connection: one end of a socketpair() is attached as a client,
+   the other end is returned to the caller who can talk IRC over it without any TCP involved.
+*/
+int		Server::ConnectLoopback(void) {
+	int	pair[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == -1) {
+		std::cerr << "Error: Couldn't create loopback connection!" << std::endl;
+		return -1;
+	}
+	AttachConnection(pair[0]);
+	return pair[1];
+}
+
 /*
  - Inserts file descriptors generated by accept() into a queue for poll() function.
 */
@@ -133,7 +333,7 @@ void	Server::InsertSocketFileDescriptorToPollQueue(const int connection_fd) {
 	struct pollfd tmp;
 
 	tmp.fd = connection_fd;
-	tmp.events = POLLIN | POLLOUT;
+	tmp.events = POLLIN;
 	this->c_fd_queue.push_back(tmp);
 }
 
@@ -148,6 +348,18 @@ void	 Server::CloseConnections(void) {
 	if (this->server_socket_fd > 2) {
 		close(this->server_socket_fd);
 	}
+	if (this->tls_socket_fd > 2) {
+		close(this->tls_socket_fd);
+	}
+	if (this->unix_socket_fd > 2) {
+		close(this->unix_socket_fd);
+		unlink(this->unix_path.c_str());
+	}
+	if (this->metrics_socket_fd > 2) {
+		close(this->metrics_socket_fd);
+	}
+	while (!this->metrics_conns.empty())
+		CloseMetricsConnection(this->metrics_conns.begin()->first);
 	PreformServerCleanup();
 }
 
@@ -189,22 +401,28 @@ void	Server::PreformServerCleanup(void) {
 /*
  - Wrapper function for PopOutClientFd
 */
-void	Server::DeleteClient(int client_fd) {
+void	Server::DeleteClient(int client_fd, DisconnectReason reason) {
 
     std::list<Channel>::iterator channel_it;
-	channel_it = this->_channels.begin();
 	Client& client = *this->GetClient(client_fd);
-	for (; channel_it != this->_channels.end(); ++channel_it)
+	SendToNeighbors(client, _user_info(client, true) + "QUIT :Quit: Leaving\r\n");
+	for (channel_it = this->_channels.begin(); channel_it != this->_channels.end(); ++channel_it)
 	{
+		channel_it->forgetClient(client);
 		if (channel_it->onChannel(client))
-		{
-			channel_it->sendToAll(client, _user_info(client, true) + "QUIT :Quit: Leaving\r\n");
 			channel_it->removeMember(client);
-		}
 	}
+	this->_metrics.sendq_shed += client.GetShedCount();
+	if (client.IsFlushPending())
+		this->flush_queue.erase(std::find(this->flush_queue.begin(), this->flush_queue.end(), &client));
+	this->_clones.Release((const struct sockaddr *)&client.GetAddress());
+	this->_streams.erase(client_fd);
+	this->_users.Remove(client);
+	this->_tls.Close(client.GetTls());
 	close(client_fd);
 	PopOutClientFd(client_fd);
 	this->client_count--;
+	++this->_metrics.disconnects[reason];
 }
 
 /*
@@ -215,8 +433,7 @@ void	Server::CopySockData(int client_fd) {
 
     while (itc != clients.end()) {
         if (itc->getSockID() == client_fd) {
-            itc->client_sock_data = this->client_sock_data;
-            itc->socket_data_size = this->socket_data_size;
+            itc->SetAddress(this->client_sock_data);
         }
         ++itc;
     }
@@ -232,6 +449,7 @@ void	Server::InsertClient(int client_fd) {
 
         fcntl(client_fd, F_SETFL, O_NONBLOCK);
 		this->clients.push_back(User);
+		this->clients.back().SetFlushQueue(&this->flush_queue);
 		CopySockData(client_fd);
 		InsertSocketFileDescriptorToPollQueue(client_fd);
 		//send(client_fd, INTRO, _strlen(INTRO), 0);
@@ -266,42 +484,227 @@ std::list<Client>::iterator &Server::GetClient(int client_fd) {
 }
 
 /*
- 	- Reads the input given by a certain client and stores it in a special buffer accessible only
-      for that client.
+	- Client with the nick, casefolded (RFC 1459). A nick nobody has is answered from the
+	  interning pool without touching the client list.
+*/
+std::list<Client>::iterator Server::FindNick(const std::string& nick) {
+    IString folded;
+
+    if (!IString::FindFolded(nick, folded))
+        return (clients.end());
+    return (std::find(clients.begin(), clients.end(), folded));
+}
+
+/*
+	- Reads the input given by a certain client and stores it in a special buffer accessible only
+	  for that client.
+	- One recv() of at most MAX_BYTES_PER_TICK per tick, whatever is left stays in the socket
+	  and poll() reports it again on the next tick, so a fast sender can't hog an iteration.
+	- Flood exempt clients are never cut off for excess flood, they stop being read instead
+	  once MAX_IRC_RECVQ bytes are waiting and the kernel's buffer pushes back on them.
+	- Returns false when the peer has closed the connection.
 */
-void 	Server::ReadClientFd(int client_fd) {
-    char buf[MAX_IRC_MSGLEN];
+bool 	Server::ReadClientFd(int client_fd) {
+    char buf[MAX_BYTES_PER_TICK];
     std::list<Client>::iterator it = GetClient(client_fd);
-    std::string tmp;
-    _bzero(buf, MAX_IRC_MSGLEN);
-    while (SRH) {
-        int rb = recv(client_fd, buf, MAX_IRC_MSGLEN, 0);
-        if (rb > 0 && rb < MAX_IRC_MSGLEN && errno != EPIPE) {
-            buf[rb] = 0;
-            tmp = buf;
-            it->SetBuffer(it->GetBuffer() + tmp);
-        } else if (rb <= 0 || errno == EPIPE) {
-            // std::cout << it->GetBuffer() << std::endl;
-            // GetClient(client_fd)->SetBuffer(GetClient(client_fd)->GetBuffer() + tmp);
-            break ;
+
+    if (it->IsFloodExempt() && it->GetBuffer().length() >= MAX_IRC_RECVQ)
+        return true;
+    if (it->GetTls())
+        return ReadTlsClient(*it);
+    int rb = recv(client_fd, buf, MAX_BYTES_PER_TICK, 0);
+    if (rb == 0 || (rb < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+        return false;
+    if (rb > 0) {
+        this->_metrics.bytes_in += rb;
+        it->AppendBuffer(buf, rb);
+    }
+    return true;
+}
+
+/*
+	- TLS clients are read one record at a time: bytes OpenSSL already decrypted don't show up
+	  in poll(), so the rest of a record is taken even past MAX_BYTES_PER_TICK.
+	- Output queued before the handshake was done is flushed as soon as it is.
+*/
+bool	Server::ReadTlsClient(Client& client) {
+    char buf[TLS_RECORD_SIZE];
+    TlsConnection* tls = client.GetTls();
+    bool was_established = tls->established;
+
+    ssize_t rb = this->_tls.Read(tls, buf, sizeof(buf));
+    if (rb < 0)
+        return false;
+    if (rb > 0) {
+        this->_metrics.bytes_in += rb;
+        client.AppendBuffer(buf, rb);
+    }
+    if (!was_established && tls->established && client.QueuedBytes())
+        FlushClient(client);
+    return true;
+}
+
+/*
+	- Sends as much of the client's queued output as the socket takes in one writev(),
+	  control output first and bulk output behind it.
+	- Whatever is left waits for POLLOUT, which is only asked for while output is stuck,
+	  otherwise poll() would report every idle connection as writable on every call.
+	- TLS clients go through FlushTlsClient(), unless kTLS encrypts for them in the kernel.
+*/
+void	Server::FlushClient(Client& client) {
+    std::string& control = client.GetMessageBuffer();
+    std::string& bulk = client.GetBulkBuffer();
+    TlsConnection* tls = client.GetTls();
+    int client_fd = client.getSockID();
+    struct iovec iov[2];
+    int count = 0;
+
+    if (tls && (!tls->ktls_send || !tls->out.empty()))
+        FlushTlsClient(client);
+    if (!tls || (tls->ktls_send && tls->out.empty())) {
+        if (!control.empty()) {
+            iov[count].iov_base = const_cast<char *>(control.data());
+            iov[count++].iov_len = control.length();
+        }
+        if (!bulk.empty()) {
+            iov[count].iov_base = const_cast<char *>(bulk.data());
+            iov[count++].iov_len = bulk.length();
+        }
+    }
+    if (count) {
+        Watchdog::Enter("send", client_fd);
+        ssize_t sent = writev(client_fd, iov, count);
+        if (sent > 0) {
+            size_t from_control = std::min((size_t)sent, control.length());
+            this->_metrics.bytes_out += sent;
+            this->_metrics.messages_out += std::count(control.begin(), control.begin() + from_control, '\n')
+                + std::count(bulk.begin(), bulk.begin() + (sent - from_control), '\n');
+            client.ConsumeMessage(sent);
+        }
+        else if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            client.DropMessages(); // the peer is gone, the hangup reaps the client
+    }
+    bool blocked = client.QueuedBytes() > 0 || (tls && !tls->out.empty());
+    if (tls && !tls->established)
+        blocked = false; // waits for the handshake, see ReadTlsClient()
+    if (!blocked && this->_streams.count(client_fd))
+        blocked = true; // room for the next chunk of a streamed reply, see StreamReply()
+    if (blocked != client.IsWriteBlocked()) {
+        client.SetWriteBlocked(blocked);
+        WatchWritable(client_fd, blocked);
+    }
+}
+
+/*
+	- TLS output goes through SSL_write() one record's worth at a time: the bytes are staged from
+	  the client's queues into tls->out, which is retried as is until the socket took all of it.
+	- Staging goes through ConsumeMessage(), a bulk line cut at the record boundary keeps its
+	  rest ahead of any control output queued later.
+*/
+void	Server::FlushTlsClient(Client& client) {
+    std::string& control = client.GetMessageBuffer();
+    std::string& bulk = client.GetBulkBuffer();
+    TlsConnection* tls = client.GetTls();
+
+    if (!tls->established)
+        return ;
+    Watchdog::Enter("send", client.getSockID());
+    while (!tls->out.empty() || client.QueuedBytes()) {
+        if (tls->out.empty()) {
+            size_t from_control = std::min(control.length(), (size_t)TLS_RECORD_SIZE);
+            size_t from_bulk = std::min(bulk.length(), TLS_RECORD_SIZE - from_control);
+
+            tls->out.assign(control, 0, from_control);
+            tls->out.append(bulk, 0, from_bulk);
+            this->_metrics.messages_out += std::count(tls->out.begin(), tls->out.end(), '\n');
+            client.ConsumeMessage(from_control + from_bulk);
+        }
+        ssize_t sent = this->_tls.Write(tls);
+        if (sent < 0) {
+            tls->out.clear();
+            client.DropMessages(); // the peer is gone, the hangup reaps the client
+            return ;
+        }
+        this->_metrics.bytes_out += sent;
+        if (!tls->out.empty() || tls->ktls_send)
+            return ; // stuck, or the kernel encrypts from here on and writev() takes the rest
+    }
+}
+
+/*
+	- Flush phase, run once at the end of every loop tick: each client that got output
+	  during the tick is written once, with everything queued for it in one send().
+*/
+void	Server::FlushClients(void) {
+    std::vector<Client*> pending;
+
+    pending.swap(this->flush_queue);
+    for (size_t i = 0; i < pending.size(); i++) {
+        pending[i]->SetFlushPending(false);
+        if (!pending[i]->IsWriteBlocked())
+            FlushClient(*pending[i]);
+    }
+    pending.clear();
+    if (this->flush_queue.empty())
+        this->flush_queue.swap(pending);
+}
+
+/*
+	- Sends msg once to every client sharing at least one channel with client (client excluded),
+	  however many channels they share: recipients are stamped with a generation number
+	  for this event as they get the line, so the cost follows unique neighbors.
+*/
+void	Server::SendToNeighbors(Client& client, const std::string& msg, MessagePriority priority) {
+    std::list<Channel>::iterator channel_it;
+
+    client.MarkFanout(++this->fanout_generation);
+    for (channel_it = this->_channels.begin(); channel_it != this->_channels.end(); ++channel_it)
+        if (channel_it->onChannel(client))
+            channel_it->sendToUnmarked(this->fanout_generation, msg, priority);
+}
+
+void	Server::WatchWritable(int fd, bool enable) {
+    SetPollEvents(fd, enable ? POLLIN | POLLOUT : POLLIN);
+}
+
+void	Server::SetPollEvents(int fd, short events) {
+    for (size_t i = 0; i < this->c_fd_queue.size(); i++) {
+        if (this->c_fd_queue[i].fd == fd) {
+            this->c_fd_queue[i].events = events;
+            return ;
         }
     }
 }
 
 /*
-	- Sends the message to a client, in this case it'll be used to send messages
-	  to all clients connected.
+	- The socket has room again for output left over by an earlier flush, or for the next
+	  chunk of a streamed reply.
 */
 void	Server::SendClientMessage(int client_fd) {
     std::list<Client>::iterator it = GetClient(client_fd);
 
-	if (!it->GetMessageBuffer().empty()) {
-		send(client_fd, it->GetMessageBuffer().c_str(), it->GetMessageBuffer().length(), 0);
-        if (errno == EPIPE)
-            return ;
-	}
-    it->SetMessage("");
-	send_buffer.clear();
+    if (it != clients.end()) {
+        StreamReply(*it);
+        FlushClient(*it);
+    }
+}
+
+/*
+	- Extends the client's streamed reply by up to SENDQ_LOW_WATERMARK bytes once its SendQ
+	  drained under that, so a WHO on thousands of members costs one chunk per POLLOUT instead
+	  of building everything in one go.
+	- The client's own lines are held while its reply streams (see Interpreter()), the last
+	  chunk lets them run again.
+*/
+void	Server::StreamReply(Client& client) {
+    std::map<int, t_reply_stream>::iterator it = this->_streams.find(client.getSockID());
+
+    if (it == this->_streams.end() || client.QueuedBytes() >= SENDQ_LOW_WATERMARK)
+        return ;
+    if (it->second.channel->who(client, it->second.cursor, SENDQ_LOW_WATERMARK - client.QueuedBytes())) {
+        this->_streams.erase(it);
+        ScheduleClient(client.getSockID());
+    }
 }
 
 /*
@@ -319,7 +722,7 @@ void	Server::KickClients(void) {
 
 	while (it != clients.end()) {
 		if (it->ShouldBeKicked() == true) {
-			DeleteClient(it->getSockID());
+			DeleteClient(it->getSockID(), DISCONNECT_KICKED);
 		}
 		++it;
 	}
@@ -329,7 +732,7 @@ void	Server::KickClients(void) {
 */
 bool    Server::CheckDataValidity(int client_fd) {
     std::list<Client>::iterator it = GetClient(client_fd);
-    return (it->GetBuffer().find("\r\n") != std::string::npos);
+    return (it->HasPendingLine());
 }
 
 bool   Server::CheckLoginTimeout(int client_fd) {
@@ -337,7 +740,7 @@ bool   Server::CheckLoginTimeout(int client_fd) {
 	if (it != clients.end()) {
     	if (_gettime() -  it->GetLastUserActivity() > MAX_TIMEOUT_DURATION && it->JustConnectedStatus()) {
     	    std::cout << "Client F_ID: " << client_fd << " timed out." << std::endl;
-    	    DeleteClient(client_fd);
+    	    DeleteClient(client_fd, DISCONNECT_TIMEOUT);
     	    return true;
     	}
 	}
@@ -436,7 +839,7 @@ void	Server::Authenticate(int client_fd) {
 						size_t pos = tmp[3].find(":", 0);
                 	    it->SetName(tmp[0]);
                 	    it->SetHostname(tmp[1]);
-                	    it->SetServername(inet_ntoa(it->client_sock_data.sin_addr));
+                	    it->SetServername(inet_ntoa(it->GetAddress().sin_addr));
 						if (pos != std::string::npos)
                 	    	tmp[3].erase(pos, 1);
                 	    it->SetRealname(tmp[3]);
@@ -447,26 +850,103 @@ void	Server::Authenticate(int client_fd) {
 	    		pass = std::strtok(NULL, "\r\n");
 	    	}
 	    	if (temp_pass != password) {
-	    		DeleteClient(client_fd);
+	    		DeleteClient(client_fd, DISCONNECT_BAD_PASSWORD);
 	    		return ;
 	    	}
             it->SetBuffer("");
+            if (!it->JustConnectedStatus()) {
+                this->_users.Add(*it);
+                SendWelcome(*it);
+            }
 	    }
     }
 }
 
+/*
+ - Registration burst: RPL_WELCOME, then RPL_ISUPPORT with the limits clients have to know about,
+   TARGMAX tells them how many comma separated targets one PRIVMSG/NOTICE may carry.
+*/
+void	Server::SendWelcome(Client& client) {
+    std::stringstream tokens;
+
+    tokens << "CHANTYPES=# CHANMODES=be,k,l,it EXCEPTS MAXLIST=be:" << MAX_CHANNEL_BANS << " PREFIX=(o)@ TARGMAX=PRIVMSG:" << MAX_TARGETS << ",NOTICE:" << MAX_TARGETS;
+    client.SetMessage(_user_info(client, false) + RPL_WELCOME(client.getNick(), client.getNick() + "!" + client.getName() + "@" + client.getHostname()));
+    client.SetMessage(_user_info(client, false) + RPL_ISUPPORT(client.getNick(), tokens.str()));
+}
+
 bool    Server::ProccessIncomingData(int client_fd) {
-    ReadClientFd(client_fd);
+    Watchdog::Enter("read", client_fd);
+    if (!ReadClientFd(client_fd)) {
+        std::cout << "Client has disconnected, IP: " << inet_ntoa(this->client_sock_data.sin_addr) << std::endl;
+        DeleteClient(client_fd, DISCONNECT_HANGUP);
+        return true;
+    }
+    if (CheckExcessFlood(client_fd))
+        return true;
+    if (JustConnected(client_fd))
+        return ProcessClientLines(client_fd);
+    ScheduleClient(client_fd);
+    return false;
+}
+
+/*
+	- (Re)reads the D-line file into a new tree and swaps it in, a file that can't be read
+	  keeps the current bans. Connected clients inside a new ban are dropped, unix socket
+	  peers aside (see AcceptIncomingConnections()).
+*/
+void    Server::ReloadDlines(void) {
+    DlineTree loaded;
+    std::vector<std::pair<int, std::string> > banned;
+
+    if (!loaded.Load(this->dline_path, std::cerr)) {
+        std::cerr << "Error: Couldn't read D-line file " << this->dline_path << ", keeping " << this->_dlines.Size() << " bans" << std::endl;
+        return ;
+    }
+    this->_dlines.Swap(loaded);
+    std::cout << "Loaded " << this->_dlines.Size() << " D-lines from " << this->dline_path << std::endl;
+    for (std::list<Client>::iterator it = clients.begin(); it != clients.end(); ++it) {
+        const std::string* reason = this->_dlines.Match((const struct sockaddr *)&it->GetAddress());
+        if (reason && !IsUnixPeer(it->getSockID()))
+            banned.push_back(std::make_pair(it->getSockID(), "ERROR :Closing Link: " + it->getServername() + " (" + *reason + ")\r\n"));
+    }
+    for (size_t i = 0; i < banned.size(); i++) {
+        send(banned[i].first, banned[i].second.c_str(), banned[i].second.length(), MSG_DONTWAIT);
+        DeleteClient(banned[i].first, DISCONNECT_DLINED);
+    }
+}
+
+/*
+    - Lines that are over the client's flood budget stay in its buffer, once the buffer
+      grows past MAX_IRC_RECVQ the client is disconnected for excess flood.
+*/
+bool    Server::CheckExcessFlood(int client_fd) {
+    std::list<Client>::iterator it = GetClient(client_fd);
+
+    if (it == clients.end() || it->IsFloodExempt() || it->GetBuffer().size() <= MAX_IRC_RECVQ)
+        return false;
+    std::string error = "ERROR :Closing Link: " + it->getServername() + " (Excess Flood)\r\n";
+    send(client_fd, error.c_str(), error.length(), MSG_DONTWAIT);
+    std::cout << "Client F_ID: " << client_fd << " disconnected for excess flood." << std::endl;
+    DeleteClient(client_fd, DISCONNECT_EXCESS_FLOOD);
+    return true;
+}
+
+/*
+    - Runs the complete lines waiting in the client's buffer, returns true if the client is gone.
+*/
+bool    Server::ProcessClientLines(int client_fd) {
     if (CheckDataValidity(client_fd)) {
-	    if (JustConnected(client_fd))
+	    if (JustConnected(client_fd)) {
+            Watchdog::Enter("authenticate", client_fd);
 	   	 	Authenticate(client_fd);
+        }
 		else {
             try {
 	    	    Interpreter(client_fd);
                 raw_data.clear();
             }  
             catch (Server::ClientQuitException &e) {
-                DeleteClient(client_fd);
+                DeleteClient(client_fd, DISCONNECT_QUIT);
                 std::cout << "Client has disconnected, IP: " << inet_ntoa(this->client_sock_data.sin_addr) << std::endl;
                 return true;
             }
@@ -475,13 +955,62 @@ bool    Server::ProccessIncomingData(int client_fd) {
     return false;
 }
 
-bool    Server::AcceptIncomingConnections(void) {
+/*
+	- Accepts everything pending on listener_fd, connections made to the TLS listener
+	  start their handshake with the first bytes they send.
+	- Unix socket peers are recorded as 127.0.0.1 (never D-lined or clone limited), those
+	  running as the server's user or root are trusted like an oper's bot: flood exempt.
+*/
+bool    Server::AcceptIncomingConnections(int listener_fd) {
     int new_client_fd = -1;
+    int nodelay = 1;
+    bool local = (listener_fd == this->unix_socket_fd);
+    if (listener_fd < 0)
+        return false;
     do {
-        new_client_fd = accept(this->server_socket_fd, (struct sockaddr *)&this->client_sock_data, &this->socket_data_size);
+        this->socket_data_size = sizeof(this->client_sock_data);
+        if (local) {
+            new_client_fd = accept(listener_fd, NULL, NULL);
+            _bzero(&this->client_sock_data, sizeof(this->client_sock_data));
+            this->client_sock_data.sin_family = AF_INET;
+            this->client_sock_data.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        }
+        else {
+            new_client_fd = accept(listener_fd, (struct sockaddr *)&this->client_sock_data, &this->socket_data_size);
+        }
 	    if (new_client_fd > 0) {
-	    	std::cout << "Connected IP: " << inet_ntoa(this->client_sock_data.sin_addr) << std::endl;
+	    	++this->_metrics.accepted;
+	    	if (!local && this->_dlines.Match((struct sockaddr *)&this->client_sock_data)) {
+	    		++this->_metrics.refused[REFUSED_DLINE];
+	    		close(new_client_fd);
+	    		continue ;
+	    	}
+	    	if (!this->_clones.Admit((struct sockaddr *)&this->client_sock_data)) {
+	    		++this->_metrics.refused[REFUSED_CLONES];
+	    		close(new_client_fd);
+	    		continue ;
+	    	}
+	    	if (local)
+	    		std::cout << "Connected local peer on " << this->unix_path << std::endl;
+	    	else {
+	    		// replies are already coalesced into one send() per tick, Nagle would only delay them
+	    		setsockopt(new_client_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+	    		if (this->busy_poll_us)
+	    			SetBusyPoll(new_client_fd);
+	    		std::cout << "Connected IP: " << inet_ntoa(this->client_sock_data.sin_addr) << std::endl;
+	    	}
 	    	InsertClient(new_client_fd);
+	    	if (local && IsTrustedPeer(new_client_fd))
+	    		this->clients.back().SetFloodExempt(true);
+	    	if (listener_fd == this->tls_socket_fd) {
+	    		TlsConnection* tls = this->_tls.Accept(new_client_fd);
+
+	    		if (!tls) {
+	    			DeleteClient(new_client_fd, DISCONNECT_HANGUP);
+	    			continue ;
+	    		}
+	    		this->clients.back().SetTls(tls);
+	    	}
 	    	std::cout << "Total Clients: " << clients.size() << std::endl;
 	    }
     }
@@ -503,41 +1032,154 @@ bool    Server::AcceptIncomingConnections(void) {
 void	Server::OnServerFdQueue(void) {
 	std::list<Channel>::iterator channel_it;
 	for (size_t i = 0; i < this->c_fd_queue.size(); i++) {
+		if (this->c_fd_queue[i].fd == this->metrics_socket_fd) {
+			if (this->c_fd_queue[i].revents & POLLIN)
+				AcceptMetricsConnections();
+			continue ;
+		}
+		if (IsMetricsConnection(this->c_fd_queue[i].fd)) {
+			if (this->c_fd_queue[i].revents && ServeMetrics(this->c_fd_queue[i].fd, this->c_fd_queue[i].revents))
+				i--; // the next entry moved into this slot
+			continue ;
+		}
 		if (this->c_fd_queue[i].revents == (POLLIN | POLLHUP)) {
 			std::cout << "Client has disconnected, IP: " << inet_ntoa(this->client_sock_data.sin_addr) << std::endl;
-			DeleteClient(c_fd_queue[i].fd);
+			DeleteClient(c_fd_queue[i].fd, DISCONNECT_HANGUP);
+			i--; // the next entry moved into this slot
+			continue ;
 		}
-		else if (this->c_fd_queue[i].revents & POLLIN) {
-            if (this->c_fd_queue[i].fd == this->server_socket_fd) {
-				AcceptIncomingConnections();
+		if (this->c_fd_queue[i].revents & POLLIN) {
+            if (IsListener(this->c_fd_queue[i].fd)) {
+				AcceptIncomingConnections(this->c_fd_queue[i].fd);
 				continue ;
 			}
         	if (ProccessIncomingData(c_fd_queue[i].fd))
 				return ;
         }
-		else if (this->c_fd_queue[i].revents & POLLOUT) {
+		if (this->c_fd_queue[i].revents & POLLOUT)
 			SendClientMessage(c_fd_queue[i].fd);
-            send_buffer.clear();
-		}
 	}
 }
 
 /*
-	- Non-ending loop that accepts and registers client data.
-	- poll() a function that allows for events that happened
-	  in all fds, which means you can check multiple fds for
-	  write/read events, (if a fd has data to read from or if it's available to write on)
-	- Registers file descriptors into a poll queue for it later to be checked by OnServerFdQueue()
+	- Non-ending loop, one OnServerTick() per iteration until a signal stops the server.
+	- Blocks in poll() until a socket or a signal needs the loop, or until a client with
+	  buffered lines can go on (see PollTimeout()).
+	- With a spin budget (SetLowLatencyMode()) it keeps polling without blocking for that
+	  long after the last event, so the next message doesn't pay for a sleep and a wakeup.
 */
 void	Server::OnServerLoop(void) {
 	while (SRH) {
-	int 	poll_num = poll(&this->c_fd_queue[0], this->c_fd_queue.size(), 0);
+		int timeout = PollTimeout();
+		if (timeout != 0 && this->spin_budget_ns && _gettime_ns() - this->last_event_ns < this->spin_budget_ns)
+			timeout = 0;
+		OnServerTick(timeout);
+	}
+}
+
+/*
+	- poll() timeout for the next tick: none while the ready queue is empty, otherwise
+	  until the first queued client is out of flood penalty (0 if one already is).
+	- At most a second while metrics connections are open, so idle ones get reaped.
+*/
+int		Server::PollTimeout(void) const {
+	int timeout = (this->ready_fds.empty() ? -1 : this->ready_wait_ms);
 
-	AcceptIncomingConnections();
+	if (!this->metrics_conns.empty() && (timeout < 0 || timeout > 1000))
+		timeout = 1000;
+	return (timeout);
+}
 
+/*
+	- Opt-in low latency mode, every argument <= 0 leaves that part off:
+	  cpu pins the event loop to one CPU,
+	  busy_poll_us sets SO_BUSY_POLL (and SO_PREFER_BUSY_POLL) on the listener and every accepted
+	  socket so the kernel polls the NIC queue instead of waiting for its interrupt,
+	  spin_us is how long the loop keeps polling without blocking after the last event.
+*/
+bool	Server::SetLowLatencyMode(long cpu, long busy_poll_us, long spin_us) {
+	if (cpu >= 0) {
+		cpu_set_t set;
+
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+			std::cerr << "Error: Couldn't pin the event loop to CPU " << cpu << ": " << std::strerror(errno) << std::endl;
+			return 1;
+		}
+		std::cout << "Event loop pinned to CPU " << cpu << std::endl;
+	}
+	this->busy_poll_us = (busy_poll_us > 0 ? busy_poll_us : 0);
+	this->spin_budget_ns = (spin_us > 0 ? spin_us * 1000ULL : 0);
+	if (this->busy_poll_us && this->server_socket_fd >= 0) {
+		SetBusyPoll(this->server_socket_fd);
+		if (this->tls_socket_fd >= 0)
+			SetBusyPoll(this->tls_socket_fd);
+		std::cout << "Busy polling sockets for " << this->busy_poll_us << "us" << std::endl;
+	}
+	if (this->spin_budget_ns)
+		std::cout << "Event loop spins for " << spin_us << "us before blocking" << std::endl;
+	return 0;
+}
+
+void	Server::SetBusyPoll(int fd) {
+	if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &this->busy_poll_us, sizeof(this->busy_poll_us)) == -1 && fd == this->server_socket_fd)
+		std::cerr << "Warning: SO_BUSY_POLL: " << std::strerror(errno) << " (needs CAP_NET_ADMIN)" << std::endl;
+#ifdef SO_PREFER_BUSY_POLL
+	int prefer = 1;
+	setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer, sizeof(prefer));
+#endif
+}
+
+/*
+	- One iteration of the event loop, waits up to timeout milliseconds for events.
+	- Exposed so embedders (tests, benchmarks) can advance the server one step at a time.
+*/
+void	Server::OnServerTick(int timeout) {
+	int 	poll_num = 0;
+
+	if (!this->c_fd_queue.empty())
+		poll_num = poll(&this->c_fd_queue[0], this->c_fd_queue.size(), timeout);
+
+	unsigned long long start = _gettime_ns();
+	if (poll_num > 0)
+		this->last_event_ns = start;
+	Watchdog::BeginIteration();
 	if (poll_num > 0)
 		OnServerFdQueue();
+	ProcessPendingClients();
+	FlushClients();
+	ReapInvites();
+	ReapMetricsConnections();
+	Watchdog::EndIteration();
+	if (poll_num > 0)
+		this->_metrics.loop_iteration_ns.Observe(_gettime_ns() - start);
+	if (g_dline_reload_requested) {
+		g_dline_reload_requested = 0;
+		ReloadDlines();
 	}
+	if (g_metrics_dump_requested) {
+		g_metrics_dump_requested = 0;
+		DumpCommandLatencies();
+	}
+}
+
+/*
+	- Expired channel invites are dropped at most once a second, on the first tick of that second:
+	  an idle server blocks in poll() and keeps them, but then nothing adds new ones either.
+*/
+void	Server::ReapInvites(void) {
+	size_t now = _gettime();
+
+	if (now == this->last_invite_reap)
+		return ;
+	this->last_invite_reap = now;
+	for (std::list<Channel>::iterator channel_it = this->_channels.begin(); channel_it != this->_channels.end(); ++channel_it)
+		channel_it->reapInvites(now);
+}
+
+void	Server::Run(void) {
+	OnServerLoop();
 }
 /**
  * Prints the command data from the given Parse object.
@@ -565,14 +1207,15 @@ void    Server::PrintCommandData(Parse &Data) {
     std::cout << std::endl;
 }
 
-void  	Server::CreateCommandData(int client_fd, CommandType type) {
-    std::list<Client>::iterator xit = std::find(clients.begin(), clients.end(), client_fd);
-    std::string str = xit->GetBuffer();
+void  	Server::CreateCommandData(const std::string &line, CommandType type) {
+    std::string str = line;
     std::string Accumulated_Message(str);
     std::vector<std::string> args;
     std::vector<std::string> targets;
     
     targets.clear();
+    this->_data->setCommand("");
+    this->_data->setMessage("");
     char    *token = std::strtok(const_cast<char *>(str.c_str()), " ");
     if (token)
         this->_data->setCommand(token);
@@ -599,6 +1242,7 @@ void  	Server::CreateCommandData(int client_fd, CommandType type) {
         }
         this->_data->setTarget(targets);
         args.clear();
+        this->_data->setArgs(args);
     } else if (type == MSGNOTINCLUDED) {
         this->_data->setArgs(args);
         this->_data->setMessage("");
@@ -608,50 +1252,105 @@ void  	Server::CreateCommandData(int client_fd, CommandType type) {
     this->_data->setType(type);
 }
 
+/*
+	- Looks the command up in the dispatch table and runs its handler,
+	  unknown commands are only counted.
+*/
 void    Server::ExecuteCommand(void) {
-    std::string cmd_list[9] = { "NICK", "JOIN", "WHO", "MODE", "PRIVMSG", "TOPIC", "INVITE", "KICK", "USER" };
-    void    (Server::*func[9])(void) = { &Server::nick, &Server::join, &Server::who, &Server::mode, &Server::privMsg, &Server::topic, &Server::invite, &Server::kick, &Server::user };
-
-    if (this->_data->getCommand() == "QUIT") {
-        raw_data.clear();
-        delete this->_data;
-        throw(Server::ClientQuitException());
-    }
-    for (int i = 0; i < 9; i++) {
-        if (this->_data->getCommand() == cmd_list[i]) {
-            (this->*func[i])();
+    const std::string &command = this->_data->getCommand();
+    unsigned long long now_ms = _gettime_ns() / 1000000;
+
+    for (size_t i = 0; i < _command_count; i++) {
+        if (command == _commands[i].name) {
+            ScopedTimer timer(this->_metrics.command_latency_ns[i]);
+            Watchdog::Enter(_commands[i].name, this->_data->getClient().getSockID());
+            ++this->_metrics.commands[i];
+            this->_data->getClient().AddFloodPenalty(now_ms, _commands[i].penalty);
+            (this->*_commands[i].handler)();
             return ;
         }
     }
+    ++this->_metrics.commands[_command_count];
+    this->_data->getClient().AddFloodPenalty(now_ms, FLOOD_DEFAULT_PENALTY_MS);
 }
 
 /*
-	- Note to self: Tokenizer seems somewhat done. All i need to do now is
-	to parse more
-
+	- Runs the complete lines of the client's buffer one by one, as long as
+	  the client's flood budget allows it. The rest waits for a later tick.
 */
 void	Server::Interpreter(int client_fd) 
 {
     std::list<Client>::iterator xit = std::find(clients.begin(), clients.end(), client_fd);
+    std::string line;
+    size_t lines = 0;
+    size_t bytes = 0;
+
     this->_data = new Parse(*xit);
-    std::string temp_buf = xit->GetBuffer();
-    char *str_tmp = std::strtok(const_cast<char *>(temp_buf.c_str()),  "\r\n");
-    while (str_tmp) {
-        xit->SetBuffer(str_tmp);
-        if (xit->GetBuffer().find(":", 0) != std::string::npos) {
-		    CreateCommandData(client_fd, MSGINCLUDED);
+    while (lines < MAX_LINES_PER_TICK && bytes < MAX_BYTES_PER_TICK
+        && xit->CanProcessLine(_gettime_ns() / 1000000) && !this->_streams.count(client_fd) && xit->PopLine(line)) {
+        ++lines;
+        bytes += line.length();
+        ++this->_metrics.messages_in;
+        if (line.empty())
+            continue ;
+        if (line.find(":", 0) != std::string::npos) {
+		    CreateCommandData(line, MSGINCLUDED);
 	    } else {
-	    	CreateCommandData(client_fd, MSGNOTINCLUDED);
+	    	CreateCommandData(line, MSGNOTINCLUDED);
 	    }
         PrintCommandData(*this->_data);
         ExecuteCommand();
-        xit->SetBuffer("");
-            str_tmp = std::strtok(NULL, "\r\n");
     }
     delete this->_data;
     raw_data.clear();
 }
 
+/*
+	- Queues a registered client that has complete lines buffered, at most once.
+*/
+void	Server::ScheduleClient(int client_fd) {
+    std::list<Client>::iterator it = GetClient(client_fd);
+
+    if (it == clients.end() || it->IsScheduled() || !it->HasPendingLine())
+        return ;
+    it->SetScheduled(true);
+    this->ready_fds.push_back(client_fd);
+}
+
+/*
+	- Round-robin over the ready queue: every client queued when the pass starts gets one
+	  Interpreter() quantum (MAX_LINES_PER_TICK lines, MAX_BYTES_PER_TICK bytes) and goes back
+	  to the end of the queue if it still has input, so it runs again on the next tick.
+	- Clients out of flood budget are re-armed as well, they cost one check per tick until
+	  their message timer catches up.
+	- Entries left behind by a deleted client are skipped, a new client reusing the fd
+	  isn't marked as scheduled.
+*/
+void	Server::ProcessPendingClients(void) {
+    size_t pending = this->ready_fds.size();
+    unsigned long long now_ms = _gettime_ns() / 1000000;
+
+    this->ready_wait_ms = -1;
+    while (pending-- > 0) {
+        int client_fd = this->ready_fds.front();
+        this->ready_fds.pop_front();
+        std::list<Client>::iterator it = GetClient(client_fd);
+        if (it == clients.end() || !it->IsScheduled())
+            continue ;
+        it->SetScheduled(false);
+        if (this->_streams.count(client_fd))
+            continue ; // rescheduled once its streamed reply is done
+        if (it->CanProcessLine(now_ms) && ProcessClientLines(client_fd))
+            continue ;
+        ScheduleClient(client_fd);
+        if (it->IsScheduled()) {
+            int wait = (int)std::min(it->FloodWaitMs(now_ms), (unsigned long long)FLOOD_BURST_MS);
+            if (this->ready_wait_ms < 0 || wait < this->ready_wait_ms)
+                this->ready_wait_ms = wait;
+        }
+    }
+}
+
 void	Server::nick()
 {
 	Client&		client = this->_data->getClient();
@@ -660,50 +1359,64 @@ void	Server::nick()
 	if (this->_data->getArgs().size() != 0)
 	{
 		std::string  nickname = this->_data->getArgs().at(0);
-		client_it = std::find(this->clients.begin(), this->clients.end(), nickname);
+		client_it = FindNick(nickname);
 		if (!this->CheckValidNick(nickname))
 			client.SetMessage(_user_info(client, false) + ERR_ERRONEUSNICKNAME(client.getNick(), nickname));
-		else if (client_it != this->clients.end() && nickname != client.getNick())
+		else if (client_it != this->clients.end() && &*client_it != &client)
 			client.SetMessage(_user_info(client, false) + ERR_NICKNAMEINUSE(client.getNick(), nickname));
 		else if (nickname != client.getNick())
 		{
 			client.SetMessage(_user_info(client, true) + "NICK" + " :" + nickname + "\r\n");
-			std::list<Channel>::iterator channel_it;
-			channel_it = this->_channels.begin();
-			for (; channel_it != this->_channels.end(); ++channel_it)
-				if (channel_it->onChannel(client))
-					channel_it->sendToAll(client, _user_info(client, true) + "NICK :" + nickname + "\r\n");
+			SendToNeighbors(client, _user_info(client, true) + "NICK :" + nickname + "\r\n");
+			std::string	old_nick = client.getNick();
 			client.SetNick(nickname);
+			this->_users.Rename(client, old_nick);
+			for (std::list<Channel>::iterator channel_it = this->_channels.begin(); channel_it != this->_channels.end(); ++channel_it)
+			{
+				channel_it->forgetClient(client);
+				if (channel_it->onChannel(client))
+					channel_it->memberChanged();
+			}
 		}
 	}
 	else
 		client.SetMessage(_user_info(client, false) + ERR_NONICKNAMEGIVEN(client.getNick()));
 }
 
+/*
+	- JOIN #a,#b,#c key1,key2: keys pair up with channels in order, channels past the last key
+	  have none. Channels already listed earlier in the same JOIN are skipped.
+	- Every channel's burst (or error) is built into one buffer and queued once at the end,
+	  a client rejoining its channels after a reconnect gets them in one write.
+*/
 void	Server::join()
 {
-	std::string 					channel_name;
-	std::string 					channel_password;
+	std::vector<std::string>		channel_names;
+	std::vector<std::string>		channel_keys;
 	std::list<Channel>::iterator	channel_it;
+	std::string						burst;
 	Client&							client = this->_data->getClient();
 
-	channel_name =  CheckArgsValidity(true, 0) ;
-	channel_password = ( this->_data->getArgs().size() == 2 ? this->_data->getArgs().at(1) : "");
-	channel_it = std::find((*this)._channels.begin(), (*this)._channels.end(), channel_name);
-	if (channel_it != (*this)._channels.end())
+	_split(CheckArgsValidity(true, 0), ',', channel_names);
+	if (this->_data->getArgs().size() >= 2)
+		_split(this->_data->getArgs().at(1), ',', channel_keys);
+	for (size_t i = 0; i < channel_names.size(); i++)
 	{
-		if (channel_it->getHasPassword())
-		{
-			if (channel_it->getPassword() == channel_password)
-				channel_it->join(client);
-			else
-				client.SetMessage(_user_info(client, false) + ERR_BADCHANNELKEY(client.getName(), channel_it->getName()));
-		}
+		const std::string&	channel_name = channel_names[i];
+		const std::string&	channel_password = (i < channel_keys.size() ? channel_keys[i] : "");
+
+		if (std::find(channel_names.begin(), channel_names.begin() + i, channel_name) != channel_names.begin() + i)
+			continue ;
+		channel_it = std::find((*this)._channels.begin(), (*this)._channels.end(), channel_name);
+		if (channel_it == (*this)._channels.end())
+			burst += _user_info(client, false) + ERR_NOSUCHCHANNEL(client.getNick(), channel_name);
+		else if (channel_it->getHasPassword() && channel_it->getPassword() != channel_password)
+			burst += _user_info(client, false) + ERR_BADCHANNELKEY(client.getName(), channel_it->getName());
 		else
-			channel_it->join(client);
+			channel_it->join(client, burst);
 	}
-	else
-		client.SetMessage(_user_info(client, false) + ERR_NOSUCHCHANNEL(client.getNick(), channel_name));
+	if (!burst.empty())
+		client.SetMessage(burst);
 }
 
 void	Server::_setChannels()
@@ -728,11 +1441,72 @@ void	Server::who()
 		{
 			channel_it = std::find(this->_channels.begin(), this->_channels.end(), first_arg_type);
 			if (channel_it != this->_channels.end())
-				channel_it->who(client);
+			{
+				t_reply_stream	stream = { channel_it, 0 };
+
+				if (!channel_it->who(client, stream.cursor, SENDQ_LOW_WATERMARK))
+					this->_streams[client.getSockID()] = stream;
+			}
 			else
 				client.SetMessage(_user_info(client, false) + RPL_ENDOFWHO(client.getNick(), first_arg_type));
 		}
+		else
+			WhoMask(client, first_arg_type);
+	}
+}
+
+/*
+	- WHO <mask> outside channels, casefolded: a mask with a '.' or ':' is matched against hosts
+	  and peer addresses ("*.example.com", "10.0.*"), any other against nicks ("nick*").
+	- Matches come from the user index, which only walks the nicks under the mask's literal head
+	  or the hosts under its literal tail and stops at MAX_WHO_REPLIES, so only a mask starting
+	  (nick) or ending (host) with a wildcard and matching few clients goes through everyone.
+*/
+void	Server::WhoMask(Client& client, const std::string& mask)
+{
+	Mask					compiled(mask);
+	bool					by_host = (mask.find_first_of(".:") != std::string::npos);
+	std::vector<Client*>	matches;
+	std::string				reply;
+
+	if (by_host)
+		this->_users.FindHosts(compiled, MAX_WHO_REPLIES, matches);
+	else
+		this->_users.FindNicks(compiled, MAX_WHO_REPLIES, matches);
+	for (size_t i = 0; i < matches.size(); i++)
+	{
+		Client&	user = *matches[i];
+
+		reply += ":" + client.getServername() + " " + RPL_WHOREPLY(client.getNick(), std::string("*"), user.getName(),
+			user.getHostname(), user.getServername(), user.getNick(), std::string(), user.getRealname());
+	}
+	client.SetMessage(reply + _user_info(client, false) + RPL_ENDOFWHO(client.getNick(), mask));
+}
+
+/*
+	- NAMES #a,#b: the member list of each channel, unknown channels only get RPL_ENDOFNAMES.
+*/
+void	Server::names()
+{
+	std::vector<std::string>		channel_names;
+	std::list<Channel>::iterator	channel_it;
+	std::string						reply;
+	Client&							client = this->_data->getClient();
+
+	if (this->_data->getArgs().size() == 0)
+	{
+		client.SetMessage(_user_info(client, false) + RPL_ENDOFNAMES(client.getNick(), std::string("*")));
+		return ;
+	}
+	_split(this->_data->getArgs().at(0), ',', channel_names);
+	for (size_t i = 0; i < channel_names.size(); i++)
+	{
+		channel_it = std::find(this->_channels.begin(), this->_channels.end(), channel_names[i]);
+		if (channel_it != this->_channels.end())
+			reply += channel_it->showUsers(client);
+		reply += _user_info(client, false) + RPL_ENDOFNAMES(client.getNick(), channel_names[i]);
 	}
+	client.SetMessage(reply);
 }
 
 void	Server::set_or_remove(t_modes& mode_var, char mode)
@@ -787,7 +1561,7 @@ void  Server::operator_mode(Client& client, t_modes& mode_var, char mode, std::l
 	++mode_var.params_index;
 	if (!mode_var.param_to_pass.empty())
 	{
-		mode_var.member_it = std::find(this->clients.begin(), this->clients.end(), mode_var.param_to_pass);
+		mode_var.member_it = FindNick(mode_var.param_to_pass);
 		if (mode_var.member_it == this->clients.end())
 			mode_var.message_to_send += _user_info(client, false) + ERR_NOSUCHNICK(client.getNick(), mode_var.param_to_pass);
 		else
@@ -805,16 +1579,40 @@ void  Server::operator_mode(Client& client, t_modes& mode_var, char mode, std::l
 	}
 }
 
+/*
+	- +b/-b/+e/-e take a mask, completed to nick!user@host (BanList::Normalize()), and without
+	  one the list is sent instead.
+*/
+void	Server::list_mode(Client& client, t_modes& mode_var, char mode, std::list<Channel>::iterator& channel_it)
+{
+	if (mode_var.params_index >= mode_var.mode_params.size())
+	{
+		mode_var.message_to_send += channel_it->banList(client, mode);
+		return ;
+	}
+	mode_var.param_to_pass = BanList::Normalize(mode_var.mode_params.at(mode_var.params_index));
+	++mode_var.params_index;
+	mode_var.hold_message_return = channel_it->channelMode(client, mode_var.add_remove, mode, mode_var.param_to_pass);
+	if (mode_var.hold_message_return.first == 0)
+		mode_var.message_to_send += mode_var.hold_message_return.second;
+	else
+	{
+		mode_var.is_mode_used = true;
+		mode_var.string_used += mode_var.param_to_pass + " ";
+		mode_var.used_modes += mode;
+	}
+}
+
 void	Server::set_remove_mode(Client& client ,std::list<Channel>::iterator& channel_it)
 {
 	t_modes						    mode_var;
 	std::string						modes = this->_data->getArgs().at(1);
 
 	mode_var.add_remove = true;
-    mode_var.params_index = 0;
+	mode_var.params_index = 0;
 	mode_var.is_mode_used = false;
-    for (size_t i = 2; i < this->_data->getArgs().size(); i++)
-        mode_var.mode_params.push_back(this->_data->getArgs().at(i));
+	for (size_t i = 2; i < this->_data->getArgs().size(); i++)
+		mode_var.mode_params.push_back(this->_data->getArgs().at(i));
 	for (size_t i = 0; i < modes.size(); i++)
 	{
 		if (std::strchr("+-", modes.at(i)))
@@ -834,6 +1632,8 @@ void	Server::set_remove_mode(Client& client ,std::list<Channel>::iterator& chann
 		}
 		else if (modes.at(i) == 'o')
 			this->operator_mode(client, mode_var, modes.at(i), channel_it);
+		else if (std::strchr("be", modes.at(i)))
+			this->list_mode(client, mode_var, modes.at(i), channel_it);
 		else
 			mode_var.message_to_send += _user_info(client, false) + ERR_UNKNOWNMODE(_user_info(client, false) + client.getNick(), modes.at(i));
 	}
@@ -864,65 +1664,115 @@ void	Server::mode()
 }
 
 void	Server::privMsg()
+{
+	relayMessage("PRIVMSG", true);
+}
+
+void	Server::notice()
+{
+	relayMessage("NOTICE", false);
+}
+
+/*
+	- PRIVMSG/NOTICE to a comma separated list of up to MAX_TARGETS channels ("@#chan" for its
+	  operators, "~#chan" for its founder) and nicks, repeated targets only get it once.
+	- Every target the message is delivered to costs FLOOD_MESSAGE_PENALTY_MS, ExecuteCommand()
+	  charged the first one.
+	- The payload is checked once and the line encoded once, only its target field is
+	  rewritten for each destination.
+	- NOTICE never gets an error back (RFC 2812 3.3.2), it can't start a reply loop between bots.
+*/
+void	Server::relayMessage(const char *command, bool reply_errors)
 {
 	Client& 						client = this->_data->getClient();
-	size_t 							pos;
-	bool							send_to_operator;
-	bool							send_to_founder;
+	std::vector<std::string>		targets;
 	std::list<Channel>::iterator	channel_it;
-	std::list<Client>::iterator	client_it;
-	std::string						msg_to_send;
-	std::string						target;
+	std::list<Client>::iterator		client_it;
+	std::string						line;
+	std::string						error;
+	size_t							target_pos;
+	size_t							target_len;
+	size_t							delivered = 0;
+
 	if ((!this->_data->getMessage().empty() && this->_data->getTarget().size() == 0) || 
         (this->_data->getMessage().empty() && this->_data->getArgs().size() == 0))
-		client.SetMessage(_user_info(client, false) + ERR_NORECIPIENT(client.getNick(), "PRIVMSG"));
+		error = ERR_NORECIPIENT(client.getNick(), command);
 	else if (this->_data->getMessage().empty())
-			client.SetMessage(_user_info(client, false) + ERR_NOTEXTTOSEND(client.getNick()));
+		error = ERR_NOTEXTTOSEND(client.getNick());
 	else
 	{
-		target = this->_data->getTarget().at(0);
-		pos = target.find('#');
-		send_to_operator = false;
-		send_to_founder = false;
-		if (pos != std::string::npos)
+		_split(this->_data->getTarget().at(0), ',', targets);
+		if (targets.size() > MAX_TARGETS)
+			error = ERR_TOOMANYTARGETS(client.getNick(), this->_data->getTarget().at(0));
+	}
+	if (!error.empty() || targets.empty())
+	{
+		if (reply_errors && !error.empty())
+			client.SetMessage(_user_info(client, false) + error);
+		return ;
+	}
+	line = _user_info(client, true) + command + " ";
+	target_pos = line.length();
+	target_len = 0;
+	line += " :" + this->_data->getMessage() + "\r\n";
+	for (size_t t = 0; t < targets.size(); t++)
+	{
+		std::string&	target = targets[t];
+		bool			send_to_operator = false;
+		bool			send_to_founder = false;
+		size_t			pos = target.find('#');
+
+		if (target.empty() || std::find(targets.begin(), targets.begin() + t, target) != targets.begin() + t)
+			continue ;
+		if (pos != std::string::npos && target.find_first_not_of("@~") == pos)
 		{
 			for (size_t i = 0; i < pos; i++)
 			{
 				if (target.at(i) == '@')
-				{
 					send_to_operator = true;
-					target.erase(i, 1);
-				}
 				else if (target.at(i) == '~')
-				{
 					send_to_founder = true;
-					target.erase(i, 1);
-				}
 			}
-			channel_it = std::find(this->_channels.begin(), this->_channels.end(), target);	
+			channel_it = std::find(this->_channels.begin(), this->_channels.end(), target.substr(pos));
 			if (channel_it == this->_channels.end())
-				client.SetMessage(_user_info(client, false) + ERR_NOSUCHNICK(client.getNick(), target));
-			else
 			{
-				msg_to_send = ":" + client.getNick() + "!" + client.getName() + "@" + client.getHostname() + " PRIVMSG " + target + " :"+ this->_data->getMessage() + "\r\n";
-				if (send_to_operator)
-					channel_it->sendToOperators(client, msg_to_send);
-				else if(send_to_founder)
-					channel_it->sendToFounder(client, msg_to_send);
-				else 
-					channel_it->sendToAll(client, msg_to_send);
+				if (reply_errors)
+					client.SetMessage(_user_info(client, false) + ERR_NOSUCHNICK(client.getNick(), target.substr(pos)));
+				continue ;
+			}
+			if (!channel_it->canSpeak(client))
+			{
+				if (reply_errors)
+					client.SetMessage(_user_info(client, false) + ERR_CANNOTSENDTOCHAN(client.getNick(), channel_it->getName()));
+				continue ;
 			}
+			line.replace(target_pos, target_len, target, pos, std::string::npos);
+			target_len = target.length() - pos;
+			if (send_to_operator)
+				channel_it->sendToOperators(client, line, PRIORITY_BULK);
+			else if (send_to_founder)
+				channel_it->sendToFounder(client, line, PRIORITY_BULK);
+			else
+				channel_it->sendToAll(client, line, PRIORITY_BULK);
+			++delivered;
 		}
 		else
 		{
-			client_it = std::find(this->clients.begin(), this->clients.end(), target);
-			msg_to_send = ":" + client.getNick() + "!" + client.getName() + "@" + client.getHostname() + " PRIVMSG " + target + " :"+ this->_data->getMessage() + "\r\n";
+			client_it = FindNick(target);
 			if (client_it == this->clients.end())
-				client.SetMessage(_user_info(client, false) + ERR_NOSUCHNICK(client.getNick(), target));
-			else
-				client_it->SetMessage(msg_to_send);
+			{
+				if (reply_errors)
+					client.SetMessage(_user_info(client, false) + ERR_NOSUCHNICK(client.getNick(), target));
+				continue ;
+			}
+			line.replace(target_pos, target_len, target);
+			target_len = target.length();
+			client_it->SetMessage(line, PRIORITY_BULK);
+			++delivered;
 		}
 	}
+	if (delivered > 1)
+		client.AddFloodPenalty(_gettime_ns() / 1000000, (delivered - 1) * FLOOD_MESSAGE_PENALTY_MS);
 }
 
 
@@ -948,7 +1798,7 @@ void	Server::invite()
 	const std::string&				target = CheckArgsValidity(true, 0);
 	const std::string&				channel = CheckArgsValidity(true, 1);
 
-	target_it = std::find(this->clients.begin(), this->clients.end(), target);
+	target_it = FindNick(target);
 	channel_it = std::find(this->_channels.begin(), this->_channels.end(), channel);
 	if (target_it == this->clients.end())
 		client.SetMessage(_user_info(client, false) + ERR_NOSUCHNICK(client.getNick(), target));
@@ -969,7 +1819,7 @@ void	Server::kick()
 	target_name = (this->_data->getMessage().empty() ? CheckArgsValidity(true, 1) : CheckArgsValidity(false, 1)); // target
 	
 	channel_it = std::find(this->_channels.begin(), this->_channels.end(), channel_name);
-	target_it = std::find(this->clients.begin(), this->clients.end(), target_name);
+	target_it = FindNick(target_name);
 	if (channel_it == this->_channels.end())
 		client.SetMessage(_user_info(client, false) + ERR_NOSUCHCHANNEL(client.getNick(), channel_name));
 	else if (target_it == this->clients.end())
@@ -984,6 +1834,25 @@ void	Server::user()
 	client.SetMessage(_user_info(client, false) + ERR_ALREADYREGISTERED(client.getNick()));
 }
 
+/*
+	- Keepalive, answered on the control queue so it never waits behind relayed chat.
+*/
+void	Server::ping()
+{
+	Client&		client = this->_data->getClient();
+	std::string	token = (this->_data->getType() == MSGINCLUDED || this->_data->getArgs().empty()
+		? this->_data->getMessage() : this->_data->getArgs().at(0));
+
+	client.SetMessage(_user_info(client, false) + "PONG " + client.getServername() + " :" + token + "\r\n");
+}
+
+void	Server::quit()
+{
+	raw_data.clear();
+	delete this->_data;
+	throw(Server::ClientQuitException());
+}
+
 
 std::string Server::CheckArgsValidity(bool flag, size_t index) {
     std::string ret;
@@ -995,4 +1864,171 @@ std::string Server::CheckArgsValidity(bool flag, size_t index) {
     return ret;
 }
 
+/*------------------------------- metrics endpoint ---------------------------------*/
+
+/*
+ - Opt-in (IRCSERV_METRICS_PORT) listener bound to 127.0.0.1 only, every connection
+   gets one Prometheus text exposition and is closed.
+*/
+bool	Server::CreateMetricsListener(long port) {
+	struct sockaddr_in	addr;
+
+	if (port <= 0)
+		return 0;
+	if (port > 65535) {
+		std::cerr << "Error: Invalid metrics port number!" << std::endl;
+		return 1;
+	}
+	_bzero(&addr, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	this->metrics_socket_fd = CreateListener((struct sockaddr *)&addr, sizeof(addr));
+	if (this->metrics_socket_fd == -1) {
+		std::cerr << "Error: Couldn't create the metrics listener!" << std::endl;
+		return 1;
+	}
+	std::cout << "Metrics are exported on 127.0.0.1:" << port << std::endl;
+	return 0;
+}
+
+void	Server::AcceptMetricsConnections(void) {
+	int fd;
+
+	while ((fd = accept(this->metrics_socket_fd, NULL, NULL)) >= 0) {
+		t_metrics_conn&	conn = this->metrics_conns[fd];
+
+		fcntl(fd, F_SETFL, O_NONBLOCK);
+		conn.sent = 0;
+		conn.opened = _gettime();
+		InsertSocketFileDescriptorToPollQueue(fd);
+	}
+}
+
+bool	Server::IsMetricsConnection(int fd) const {
+	return (this->metrics_conns.find(fd) != this->metrics_conns.end());
+}
+
+/*
+ - The request is read up to its blank line but not parsed, any path returns the metrics.
+ - The response goes out as the socket takes it, the rest waits for POLLOUT, and the
+   connection is closed once it's all written. Returns true when the connection was closed.
+*/
+bool	Server::ServeMetrics(int fd, short revents) {
+	t_metrics_conn&	conn = this->metrics_conns[fd];
+	char			buf[MAX_IRC_MSGLEN];
+	ssize_t			rb = -1;
+
+	if (revents & (POLLERR | POLLNVAL)) {
+		CloseMetricsConnection(fd);
+		return true;
+	}
+	if (conn.response.empty()) {
+		while ((rb = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+			conn.request.append(buf, rb);
+		if (conn.request.find("\r\n\r\n") == std::string::npos && conn.request.find("\n\n") == std::string::npos
+			&& conn.request.length() <= MAX_IRC_MSGLEN) {
+			if (rb == 0 || (rb < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+				CloseMetricsConnection(fd);
+				return true;
+			}
+			return false;
+		}
+
+		std::string			body = RenderMetrics();
+		std::stringstream	response;
+
+		response << "HTTP/1.0 200 OK\r\n"
+				 << "Content-Type: text/plain; version=0.0.4\r\n"
+				 << "Content-Length: " << body.length() << "\r\n"
+				 << "Connection: close\r\n\r\n"
+				 << body;
+		conn.response = response.str();
+		conn.request.clear();
+		SetPollEvents(fd, POLLOUT);
+	}
+	rb = send(fd, conn.response.data() + conn.sent, conn.response.length() - conn.sent, MSG_DONTWAIT);
+	if (rb > 0)
+		conn.sent += rb;
+	if (conn.sent == conn.response.length() || (rb < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+		CloseMetricsConnection(fd);
+		return true;
+	}
+	return false;
+}
+
+void	Server::CloseMetricsConnection(int fd) {
+	close(fd);
+	this->metrics_conns.erase(fd);
+	PopOutClientFd(fd);
+}
+
+/*
+ - Scrapers that haven't sent a full request or read the whole response within
+   METRICS_TIMEOUT_SECONDS are dropped, PollTimeout() wakes the loop for it.
+*/
+void	Server::ReapMetricsConnections(void) {
+	size_t	now = _gettime();
+	std::map<int, t_metrics_conn>::iterator	it = this->metrics_conns.begin();
+
+	while (it != this->metrics_conns.end()) {
+		int fd = it->first;
+
+		if (now - (it++)->second.opened >= METRICS_TIMEOUT_SECONDS)
+			CloseMetricsConnection(fd);
+	}
+}
+
+/*
+ - Prints the per-command latency percentiles to stderr (SIGUSR1).
+*/
+void	Server::DumpCommandLatencies(void) const {
+	const char*	names[METRICS_MAX_COMMANDS];
+
+	for (size_t i = 0; i < _command_count; i++)
+		names[i] = _commands[i].name;
+	this->_metrics.DumpLatencies(std::cerr, names, _command_count);
+	Watchdog::Dump(std::cerr);
+}
+
+std::string	Server::RenderMetrics(void) const {
+	std::stringstream					os;
+	const char*							names[METRICS_MAX_COMMANDS];
+	size_t								registered = 0;
+	unsigned long long					shed = this->_metrics.sendq_shed;
+	Histogram							sendq, recvq;
+	std::list<Client>::const_iterator	it;
+
+	for (it = this->clients.begin(); it != this->clients.end(); ++it) {
+		registered += !it->JustConnectedStatus();
+		sendq.Observe(it->QueuedBytes());
+		shed += it->GetShedCount();
+		recvq.Observe(it->GetBuffer().size());
+	}
+	_metrics_header(os, "ircserv_clients_connected", "gauge", "Clients currently connected.");
+	os << "ircserv_clients_connected " << this->clients.size() << "\n";
+	_metrics_header(os, "ircserv_clients_registered", "gauge", "Connected clients that completed registration.");
+	os << "ircserv_clients_registered " << registered << "\n";
+	_metrics_header(os, "ircserv_channels", "gauge", "Channels on the server.");
+	os << "ircserv_channels " << this->_channels.size() << "\n";
+	_metrics_header(os, "ircserv_loop_stalls_total", "counter", "Event loop iterations that ran past IRCSERV_STALL_MS.");
+	os << "ircserv_loop_stalls_total " << Watchdog::getStallCount() << "\n";
+	_metrics_header(os, "ircserv_sendq_bytes", "histogram", "Bytes waiting to be sent, one sample per client.");
+	sendq.Render(os, "ircserv_sendq_bytes", "", 1);
+	_metrics_header(os, "ircserv_sendq_shed_messages_total", "counter", "Relayed chat messages dropped because the recipient's SendQ was full.");
+	os << "ircserv_sendq_shed_messages_total " << shed << "\n";
+	if (this->_tls.IsEnabled()) {
+		_metrics_header(os, "ircserv_tls_handshakes_total", "counter", "Completed TLS handshakes, by whether they resumed an earlier session.");
+		os << "ircserv_tls_handshakes_total{resumed=\"false\"} " << this->_tls.getHandshakes(false) << "\n";
+		os << "ircserv_tls_handshakes_total{resumed=\"true\"} " << this->_tls.getHandshakes(true) << "\n";
+	}
+	_metrics_header(os, "ircserv_recvq_bytes", "histogram", "Bytes received but not processed yet, one sample per client.");
+	recvq.Render(os, "ircserv_recvq_bytes", "", 1);
+	for (size_t i = 0; i < _command_count; i++)
+		names[i] = _commands[i].name;
+	names[_command_count] = "unknown";
+	this->_metrics.Render(os, names, _command_count + 1);
+	return os.str();
+}
+
 /*------------------------ check server connections --------------------------------*/
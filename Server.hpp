@@ -24,8 +24,13 @@
 #include <ctime>
 #include <stdexcept>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <sys/poll.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sched.h>
 #include <signal.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -33,17 +38,36 @@
 #include <cstring>
 #include <sstream>
 #include <list>
+#include <deque>
 #include "Toolkit.hpp"
 #include "Parse.hpp"
 #include "Channel.hpp"
+#include "Metrics.hpp"
+#include "CloneTable.hpp"
+#include "DlineTree.hpp"
+#include "Tls.hpp"
+#include "UserIndex.hpp"
+#include "Mask.hpp"
 
 #define MAX_IRC_CONNECTIONS 75
 #define MAX_SAME_CLIENT_CONNECTIONS 4
+#define MAX_SAME_SUBNET_CONNECTIONS 16
 #define MAX_TIMEOUT_DURATION 3
 #define MAX_IRC_MSGLEN 4096
+#define MAX_IRC_RECVQ 8192
+#define FLOOD_DEFAULT_PENALTY_MS 1000
+#define FLOOD_MESSAGE_PENALTY_MS 500 // PRIVMSG/NOTICE, per target it's delivered to
+#define MAX_LINES_PER_TICK 4
+#define MAX_BYTES_PER_TICK MAX_IRC_MSGLEN
+#define MAX_TARGETS 4
+#define MAX_WHO_REPLIES 500
+#define METRICS_TIMEOUT_SECONDS 5 // a scrape not answered and written out by then is closed
 #define SRH 1
 
 #define	ERR_NOSUCHNICK(client, nickname)	("401 " + client + " " + nickname + " :No such nick\r\n")
+#define RPL_WELCOME(client, nick)			("001 " + client + " :Welcome to the Internet Relay Network " + nick + "\r\n")
+#define RPL_ISUPPORT(client, tokens)		("005 " + client + " " + tokens + " :are supported by this server\r\n")
+#define ERR_TOOMANYTARGETS(client, target)	("407 " + client + " " + target + " :Too many targets\r\n")
 #define ERR_NORECIPIENT(client, command)	("411 " + client + " :No recipient given (" + command + ")\r\n")
 #define ERR_NOTEXTTOSEND(client)			("412 " + client + " :No text to send\r\n")
 #define ERR_NONICKNAMEGIVEN(client)			("431 " + client + " :No nickname given\r\n")
@@ -71,6 +95,15 @@
 "                \r\n"
 
 class Client;
+class Bench;
+class Server;
+
+typedef struct s_command
+{
+	const char*		name;
+	void			(Server::*handler)(void);
+	unsigned int	penalty;
+}	t_command;
 
 struct AddressData {
 	protected:
@@ -94,8 +127,32 @@ typedef struct s_modes
 	bool							is_mode_used; 
 } t_modes;
 
+/*
+ - A reply generated a chunk at a time as the client's SendQ drains (WHO on a large channel),
+   see Server::StreamReply().
+*/
+typedef struct s_reply_stream
+{
+	std::list<Channel>::iterator	channel;
+	size_t							cursor;
+} t_reply_stream;
+
+/*
+ - A connection to the metrics listener: the request read so far, then the response and how
+   much of it went out, see Server::ServeMetrics().
+*/
+typedef struct s_metrics_conn
+{
+	std::string	request;
+	std::string	response;
+	size_t		sent;
+	size_t		opened; // _gettime() at accept
+} t_metrics_conn;
+
 class Server : public AddressData
 {
+	friend class Bench;
+
 	public:
 		Server();
 		// Server(const std::string& aPort,const std::string& aPassword);
@@ -105,6 +162,12 @@ class Server : public AddressData
 		~Server();
 
 		bool	CreateServer(const std::string &port, const std::string &pass);
+		bool	CreateLoopbackServer(const std::string &pass);
+		int		AttachConnection(int connection_fd);
+		int		ConnectLoopback(void);
+		void	OnServerTick(int timeout);
+		bool	SetLowLatencyMode(long cpu, long busy_poll_us, long spin_us);
+		void	Run(void);
 
 	private:
 		size_t						client_count;
@@ -112,11 +175,34 @@ class Server : public AddressData
 		std::list<Client> 		    clients;
 		std::vector<struct pollfd>	c_fd_queue;
 		std::vector<int> 			client_fds;
+		std::deque<int>				ready_fds;
+		int							ready_wait_ms;
+		int							busy_poll_us;
+		unsigned long long			spin_budget_ns;
+		unsigned long long			last_event_ns;
+		std::vector<Client*>		flush_queue;
+		unsigned long long			fanout_generation;
+		size_t						last_invite_reap; // _gettime() of the last ReapInvites() pass
+		std::map<int, t_reply_stream>	_streams; // by client fd, one at a time per client
+		UserIndex					_users; // registered clients, for WHO <mask>
 		std::string 				raw_data;
 		std::string 				send_buffer;
 		Parse*						_data;
 		std::list<Channel>			_channels;
 		void						_setChannels();
+		Metrics						_metrics;
+		CloneTable					_clones;
+		DlineTree					_dlines;
+		std::string					dline_path;
+		TlsContext					_tls;
+		int							tls_socket_fd;
+		int							unix_socket_fd;
+		std::string					unix_path;
+		int							metrics_socket_fd;
+		std::map<int, t_metrics_conn>	metrics_conns; // by fd
+
+		static const t_command		_commands[];
+		static const size_t			_command_count;
 
 		//
 		// const std::string&	mPort;
@@ -130,19 +216,51 @@ class Server : public AddressData
 		void		CloseConnections(void);
 		int			                FindClient(int client_fd);
         std::list<Client>::iterator &GetClient(int client_fd);
+        std::list<Client>::iterator FindNick(const std::string& nick);
         bool        ProccessIncomingData(int client_fd);
-        bool        AcceptIncomingConnections();
+        bool        ProcessClientLines(int client_fd);
+        bool        CheckExcessFlood(int client_fd);
+        void        ReloadDlines(void);
+        void        ScheduleClient(int client_fd);
+        void        ProcessPendingClients(void);
+        int         PollTimeout(void) const;
+        void        SetBusyPoll(int fd);
+        bool        AcceptIncomingConnections(int listener_fd);
 		void		PreformServerCleanup(void);
 		void		CopySockData(int client_fd);
 		void		Authenticate(int client_fd);
 		void		InsertClient(int client_fd);
-		void		DeleteClient(int client_fd);
-		void		ReadClientFd(int client_fd);
+		void		DeleteClient(int client_fd, DisconnectReason reason);
+		bool		ReadClientFd(int client_fd);
 		bool		JustConnected(int socketfd);
 		void		PopOutClientFd(int client_fd);
 		void		SendClientMessage(int client_fd);
+		void		FlushClient(Client& client);
+		void		FlushClients(void);
+		void		StreamReply(Client& client);
+		void		ReapInvites(void);
+		void		WatchWritable(int fd, bool enable);
+		void		SetPollEvents(int fd, short events);
+		void		SendToNeighbors(Client& client, const std::string& msg, MessagePriority priority = PRIORITY_CONTROL);
 		bool		GenerateServerData(const std::string &port);
 		void		InsertSocketFileDescriptorToPollQueue(const int connection_fd);
+		int			CreateListener(const struct sockaddr *addr, socklen_t addr_len);
+		bool		CreateTlsListener(void);
+		bool		CreateUnixListener(void);
+		bool		IsTrustedPeer(int fd) const;
+		bool		IsUnixPeer(int fd) const;
+		bool		IsListener(int fd) const;
+		bool		ReadTlsClient(Client& client);
+		void		FlushTlsClient(Client& client);
+		/* =================Metrics================== */
+		bool		CreateMetricsListener(long port);
+		void		AcceptMetricsConnections(void);
+		bool		IsMetricsConnection(int fd) const;
+		bool		ServeMetrics(int fd, short revents);
+		void		CloseMetricsConnection(int fd);
+		void		ReapMetricsConnections(void);
+		std::string	RenderMetrics(void) const;
+		void		DumpCommandLatencies(void) const;
         void        SetNickWrapper(int client_fd, std::string const &name, std::string const &buf, size_t pos);
 		bool        CheckDataValidity(int client_fd);
         int         CheckValidNick(std::string const &name);
@@ -153,7 +271,7 @@ class Server : public AddressData
 		
         void        PrintCommandData(Parse &Data);
 		void		Interpreter(int client_fd);
-        void		CreateCommandData(int client_fd, CommandType type);
+        void		CreateCommandData(const std::string &line, CommandType type);
         void        ExecuteCommand(void);
 
         /* ===============Signal Handler============== */
@@ -162,16 +280,24 @@ class Server : public AddressData
 		void		set_remove_mode(Client& client ,std::list<Channel>::iterator& channel_it);
 		void  		limit_password_modes(Client& client, t_modes& mode_var, char mode, std::list<Channel>::iterator& channel_it);
 		void		operator_mode(Client& client, t_modes& mode_var, char mode, std::list<Channel>::iterator& channel_it);
+		void		list_mode(Client& client, t_modes& mode_var, char mode, std::list<Channel>::iterator& channel_it);
 		void		set_or_remove(t_modes& mode_var, char mode);
 		void		who();
+		void		WhoMask(Client& client, const std::string& mask);
+		void		names();
 		void		nick();
 		void		join();
 		void		topic();
 		void		invite();
 		void		mode();
 		void		privMsg();
+		void		notice();
+		void		relayMessage(const char *command, bool reply_errors);
+		void		SendWelcome(Client& client);
 		void		kick();
 		void		user();
+		void		quit();
+		void		ping();
 
     class ClientQuitException : public std::exception {
         public:
@@ -0,0 +1,229 @@
+#include <iostream>
+#include "Tls.hpp"
+
+#ifdef IRCSERV_TLS
+# include <openssl/ssl.h>
+# include <openssl/err.h>
+#endif
+
+TlsConnection::TlsConnection() : ssl(NULL), established(false), ktls_send(false)
+{}
+
+TlsContext::TlsContext() : _ctx(NULL)
+{
+	_handshakes[0] = 0;
+	_handshakes[1] = 0;
+}
+
+bool	TlsContext::IsEnabled(void) const
+{
+	return (this->_ctx != NULL);
+}
+
+unsigned long long	TlsContext::getHandshakes(bool resumed) const
+{
+	return (this->_handshakes[resumed]);
+}
+
+#ifdef IRCSERV_TLS
+
+static const unsigned char	s_session_id_context[] = "ircserv";
+
+TlsContext::~TlsContext()
+{
+	if (this->_ctx)
+		SSL_CTX_free((SSL_CTX*)this->_ctx);
+}
+
+bool	TlsContext::IsAvailable(void)
+{
+	return true;
+}
+
+static void	_tls_print_errors(const std::string& what)
+{
+	unsigned long	code;
+	char			buf[256];
+
+	std::cerr << "Error: " << what << std::endl;
+	while ((code = ERR_get_error()) != 0) {
+		ERR_error_string_n(code, buf, sizeof(buf));
+		std::cerr << "  " << buf << std::endl;
+	}
+}
+
+bool	TlsContext::Init(const std::string& cert_file, const std::string& key_file, bool ktls)
+{
+	SSL_CTX*	ctx = SSL_CTX_new(TLS_server_method());
+
+	if (!ctx) {
+		_tls_print_errors("Couldn't create the TLS context!");
+		return false;
+	}
+	SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+	if (SSL_CTX_use_certificate_chain_file(ctx, cert_file.c_str()) != 1
+		|| SSL_CTX_use_PrivateKey_file(ctx, key_file.c_str(), SSL_FILETYPE_PEM) != 1
+		|| SSL_CTX_check_private_key(ctx) != 1) {
+		_tls_print_errors("Couldn't load the TLS certificate " + cert_file + " and key " + key_file + "!");
+		SSL_CTX_free(ctx);
+		return false;
+	}
+	// resumption: stateless tickets for everyone, the session cache for TLS 1.2 session ids
+	SSL_CTX_set_session_id_context(ctx, s_session_id_context, sizeof(s_session_id_context) - 1);
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+	SSL_CTX_set_timeout(ctx, TLS_SESSION_TIMEOUT);
+	SSL_CTX_set_num_tickets(ctx, TLS_TICKETS);
+	// out is a std::string that may be reallocated between a short write and its retry
+	SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS);
+	if (ktls)
+		SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+	if (this->_ctx)
+		SSL_CTX_free((SSL_CTX*)this->_ctx);
+	this->_ctx = ctx;
+	return true;
+}
+
+TlsConnection*	TlsContext::Accept(int fd)
+{
+	SSL*			ssl = SSL_new((SSL_CTX*)this->_ctx);
+	TlsConnection*	conn;
+
+	if (!ssl)
+		return NULL;
+	if (SSL_set_fd(ssl, fd) != 1) {
+		SSL_free(ssl);
+		return NULL;
+	}
+	SSL_set_accept_state(ssl);
+	conn = new TlsConnection();
+	conn->ssl = ssl;
+	return (conn);
+}
+
+void	TlsContext::Close(TlsConnection* conn)
+{
+	if (!conn)
+		return ;
+	if (conn->established)
+		SSL_shutdown((SSL*)conn->ssl); // close_notify, one try: the socket is closed right after
+	SSL_free((SSL*)conn->ssl);
+	delete conn;
+}
+
+void	TlsContext::_established(TlsConnection* conn)
+{
+	SSL*	ssl = (SSL*)conn->ssl;
+
+	conn->established = true;
+	conn->ktls_send = BIO_get_ktls_send(SSL_get_wbio(ssl));
+	++this->_handshakes[SSL_session_reused(ssl) ? 1 : 0];
+}
+
+/*
+ - Returns the number of bytes read, 0 when nothing can be read yet (handshake in progress,
+   partial record) and -1 once the connection is closed or broken.
+ - One call drains the TLS record it started on, decrypted bytes left inside OpenSSL would
+   never show up in poll().
+*/
+ssize_t	TlsContext::Read(TlsConnection* conn, char* buf, size_t len)
+{
+	SSL*	ssl = (SSL*)conn->ssl;
+	size_t	total = 0;
+
+	ERR_clear_error();
+	while (total < len) {
+		int	rb = SSL_read(ssl, buf + total, len - total);
+
+		if (!conn->established && SSL_is_init_finished(ssl))
+			_established(conn);
+		if (rb > 0) {
+			total += rb;
+			if (SSL_pending(ssl) == 0)
+				break ;
+			continue ;
+		}
+		int	error = SSL_get_error(ssl, rb);
+		if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE)
+			break ;
+		return (total ? (ssize_t)total : -1);
+	}
+	return (total);
+}
+
+/*
+ - Encrypts and sends as much of conn->out as the socket takes, returns the number of
+   bytes sent (0 if it would block) or -1 if the connection is broken.
+*/
+ssize_t	TlsContext::Write(TlsConnection* conn)
+{
+	SSL*	ssl = (SSL*)conn->ssl;
+	size_t	total = 0;
+
+	ERR_clear_error();
+	while (total < conn->out.length()) {
+		int	wb = SSL_write(ssl, conn->out.data() + total, conn->out.length() - total);
+
+		if (wb > 0) {
+			total += wb;
+			continue ;
+		}
+		int	error = SSL_get_error(ssl, wb);
+		if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE)
+			break ;
+		conn->out.erase(0, total);
+		return (-1);
+	}
+	conn->out.erase(0, total);
+	return (total);
+}
+
+#else
+
+TlsContext::~TlsContext()
+{}
+
+bool	TlsContext::IsAvailable(void)
+{
+	return false;
+}
+
+bool	TlsContext::Init(const std::string& cert_file, const std::string& key_file, bool ktls)
+{
+	(void)cert_file;
+	(void)key_file;
+	(void)ktls;
+	std::cerr << "Error: ircserv was built without TLS support (make re TLS=1)!" << std::endl;
+	return false;
+}
+
+TlsConnection*	TlsContext::Accept(int fd)
+{
+	(void)fd;
+	return NULL;
+}
+
+void	TlsContext::Close(TlsConnection* conn)
+{
+	delete conn;
+}
+
+ssize_t	TlsContext::Read(TlsConnection* conn, char* buf, size_t len)
+{
+	(void)conn;
+	(void)buf;
+	(void)len;
+	return (-1);
+}
+
+ssize_t	TlsContext::Write(TlsConnection* conn)
+{
+	(void)conn;
+	return (-1);
+}
+
+void	TlsContext::_established(TlsConnection* conn)
+{
+	(void)conn;
+}
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef TLS_HPP
+#define TLS_HPP
+
+#include <string>
+#include <sys/types.h>
+
+#define TLS_DEFAULT_PORT 6697
+#define TLS_RECORD_SIZE 16384
+#define TLS_SESSION_TIMEOUT 7200
+#define TLS_TICKETS 2
+
+/*
+ - State of one TLS connection, owned by the server's TlsContext and referenced by its Client.
+ - out holds output already handed to the TLS layer: an SSL_write() that couldn't finish has to be
+   retried with the same bytes, so they're kept apart from the client's priority queues.
+*/
+struct TlsConnection {
+	void*		ssl;
+	std::string	out;
+	bool		established;
+	bool		ktls_send;
+
+	TlsConnection();
+};
+
+/*
+ - Server side TLS (OpenSSL), compiled in with `make TLS=1`, otherwise Init() fails and
+   nothing else is reachable.
+ - Sessions resume from stateless tickets (TLS_TICKETS per handshake, valid TLS_SESSION_TIMEOUT
+   seconds) and, for TLS 1.2 clients, from the server side session cache.
+ - With kTLS on, OpenSSL hands record encryption to the kernel once the handshake is done,
+   the connection can then be written with plain writev() like a TCP one.
+*/
+class TlsContext {
+	public:
+		TlsContext();
+		~TlsContext();
+
+		static bool		IsAvailable(void);
+		bool			Init(const std::string& cert_file, const std::string& key_file, bool ktls);
+		bool			IsEnabled(void) const;
+
+		TlsConnection*	Accept(int fd);
+		void			Close(TlsConnection* conn);
+		ssize_t			Read(TlsConnection* conn, char* buf, size_t len);
+		ssize_t			Write(TlsConnection* conn);
+
+		unsigned long long	getHandshakes(bool resumed) const;
+
+	private:
+		void*				_ctx;
+		unsigned long long	_handshakes[2];
+
+		TlsContext(const TlsContext& copy);
+		TlsContext&	operator=(const TlsContext& copy);
+
+		void			_established(TlsConnection* conn);
+};
+
+#endif // TLS_HPP
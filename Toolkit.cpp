@@ -11,6 +11,8 @@
 /* ************************************************************************** */
 
 #include <iostream>
+#include <cstdlib>
+#include <ctime>
 #include "Client.hpp"
 
 void	_bzero(void *ptr, size_t size) {
@@ -41,7 +43,7 @@ size_t	_strlen(const char *str) {
 std::string	_user_info(Client& client, bool info_type)
 {
 	return (info_type
-			? ":" + client.getNick() + "!" + client.getName() + "@" + client.getHostname() + " "
+			? client.GetPrefix()
 			: ":" + client.getServername() + " "
 		);
 }
@@ -56,4 +58,68 @@ size_t _gettime(void) {
     gettimeofday(&tm, NULL);
 
     return tm.tv_sec;
-}
\ No newline at end of file
+}
+
+/**
+ * Get a monotonic timestamp in nanoseconds, used to time the event loop.
+ *
+ * @return Nanoseconds since an arbitrary fixed point.
+ */
+unsigned long long _gettime_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Read a numeric setting from the environment.
+ *
+ * @return The value of the variable, or fallback if it's unset or not a number.
+ */
+long _getenv_num(const char *name, long fallback) {
+    const char *value = std::getenv(name);
+    char *end;
+
+    if (!value || !*value)
+        return fallback;
+    long num = std::strtol(value, &end, 10);
+    if (*end)
+        return fallback;
+    return num;
+}
+
+/**
+ * Split a comma list ("#a,#b,nick") or any other delim separated list.
+ *
+ * @param fields Cleared, then filled with the fields in order, empty ones included.
+ */
+void _split(const std::string& str, char delim, std::vector<std::string>& fields) {
+    size_t start = 0;
+    size_t end;
+
+    fields.clear();
+    while ((end = str.find(delim, start)) != std::string::npos) {
+        fields.push_back(str.substr(start, end - start));
+        start = end + 1;
+    }
+    fields.push_back(str.substr(start));
+}
+
+/*
+ - RFC 1459 casemapping: A-Z and []\~ fold to a-z and {}|^, nicks and masks are
+   compared folded.
+*/
+std::string _casefold(const std::string& str) {
+    std::string folded(str);
+
+    for (size_t i = 0; i < folded.length(); i++) {
+        char c = folded[i];
+
+        if (c >= 'A' && c <= ']')
+            folded[i] = c + ('a' - 'A');
+        else if (c == '~')
+            folded[i] = '^';
+    }
+    return (folded);
+}
@@ -13,9 +13,14 @@
 #pragma once
 #include <iostream>
 #include <sys/time.h>
+#include <vector>
 class Client;
 void		_bzero(void *ptr, size_t size);
 void		_memset(void *ptr, void *ptr2, size_t size);
 size_t		_strlen(const char *str);
 size_t      _gettime(void);
-std::string	_user_info(Client& client, bool info_type);
\ No newline at end of file
+unsigned long long	_gettime_ns(void);
+long		_getenv_num(const char *name, long fallback);
+std::string	_user_info(Client& client, bool info_type);
+void		_split(const std::string& str, char delim, std::vector<std::string>& fields);
+std::string	_casefold(const std::string& str);
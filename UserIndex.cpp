@@ -0,0 +1,176 @@
+#include <algorithm>
+#include "UserIndex.hpp"
+#include "Client.hpp"
+
+UserIndex::UserIndex() : _size(0)
+{}
+
+UserIndex::~UserIndex()
+{
+	_destroy(&_nicks);
+	_destroy(&_hosts);
+	_destroy(&_addresses);
+}
+
+/*
+ - Frees the nodes below node, node itself is a member or was freed by its parent.
+*/
+void	UserIndex::_destroy(Node* node)
+{
+	for (std::map<char, Node*>::iterator it = node->child.begin(); it != node->child.end(); ++it) {
+		_destroy(it->second);
+		delete it->second;
+	}
+	node->child.clear();
+}
+
+std::string	UserIndex::_host_key(const Client& client)
+{
+	std::string	key = client.getInternedHostname().getFolded();
+
+	std::reverse(key.begin(), key.end());
+	return (key);
+}
+
+void	UserIndex::Add(Client& client)
+{
+	_insert(&_nicks, client.getInternedNick().getFolded(), &client);
+	_insert(&_hosts, _host_key(client), &client);
+	_insert(&_addresses, client.getServername(), &client);
+	++_size;
+}
+
+/*
+ - Nothing happens for a client that isn't indexed (never registered).
+*/
+void	UserIndex::Remove(Client& client)
+{
+	if (!_holds(&_nicks, client.getInternedNick().getFolded(), &client))
+		return ;
+	_erase(&_nicks, client.getInternedNick().getFolded(), 0, &client);
+	_erase(&_hosts, _host_key(client), 0, &client);
+	_erase(&_addresses, client.getServername(), 0, &client);
+	--_size;
+}
+
+/*
+ - Moves the client from old_nick to its current nick, the host doesn't change after registration.
+   Nick changes before registration (NICK during Authenticate()) aren't indexed yet, Add() picks
+   up the final nick.
+*/
+void	UserIndex::Rename(Client& client, const std::string& old_nick)
+{
+	if (!_holds(&_nicks, _casefold(old_nick), &client))
+		return ;
+	_erase(&_nicks, _casefold(old_nick), 0, &client);
+	_insert(&_nicks, client.getInternedNick().getFolded(), &client);
+}
+
+/*
+ - Appends up to limit clients whose nick matches mask, from the subtree under its literal head.
+*/
+void	UserIndex::FindNicks(const Mask& mask, size_t limit, std::vector<Client*>& found) const
+{
+	const Node*	node = _find(&_nicks, mask.getHead());
+
+	if (node)
+		_collect(node, mask, FIELD_NICK, limit, found);
+}
+
+/*
+ - Same for hosts, from the subtree under the mask's literal tail: "*.example.com" only walks
+   the hosts ending in ".example.com". Then, for a mask an IPv4 address can match ("10.0.*"),
+   the peer addresses under its literal head.
+*/
+void	UserIndex::FindHosts(const Mask& mask, size_t limit, std::vector<Client*>& found) const
+{
+	std::string	key(mask.getTail().rbegin(), mask.getTail().rend());
+	const Node*	node = _find(&_hosts, key);
+
+	if (node)
+		_collect(node, mask, FIELD_HOST, limit, found);
+	if (mask.getMask().find_first_not_of("0123456789.*?") != std::string::npos)
+		return ;
+	node = _find(&_addresses, mask.getHead());
+	if (node)
+		_collect(node, mask, FIELD_ADDRESS, limit, found);
+}
+
+size_t	UserIndex::Size() const
+{
+	return (_size);
+}
+
+void	UserIndex::_insert(Node* root, const std::string& key, Client* client)
+{
+	Node*	node = root;
+
+	for (size_t i = 0; i < key.length(); i++) {
+		Node*&	next = node->child[key[i]];
+
+		if (!next)
+			next = new Node();
+		node = next;
+	}
+	node->clients.push_back(client);
+}
+
+/*
+ - Removes client from the node at key and frees the nodes left empty on the way back up,
+   returns true when node itself is left empty.
+*/
+bool	UserIndex::_erase(Node* node, const std::string& key, size_t depth, Client* client)
+{
+	if (depth == key.length()) {
+		std::vector<Client*>::iterator	it = std::find(node->clients.begin(), node->clients.end(), client);
+
+		if (it != node->clients.end())
+			node->clients.erase(it);
+	}
+	else {
+		std::map<char, Node*>::iterator	it = node->child.find(key[depth]);
+
+		if (it != node->child.end() && _erase(it->second, key, depth + 1, client)) {
+			delete it->second;
+			node->child.erase(it);
+		}
+	}
+	return (node->clients.empty() && node->child.empty());
+}
+
+const UserIndex::Node*	UserIndex::_find(const Node* root, const std::string& key)
+{
+	const Node*	node = root;
+
+	for (size_t i = 0; i < key.length() && node; i++) {
+		std::map<char, Node*>::const_iterator	it = node->child.find(key[i]);
+
+		node = (it == node->child.end() ? NULL : it->second);
+	}
+	return (node);
+}
+
+bool	UserIndex::_holds(const Node* root, const std::string& key, Client* client)
+{
+	const Node*	node = _find(root, key);
+
+	return (node && std::find(node->clients.begin(), node->clients.end(), client) != node->clients.end());
+}
+
+bool	UserIndex::_matches(const Client& client, const Mask& mask, Field field)
+{
+	if (field == FIELD_NICK)
+		return (mask.Match(client.getInternedNick().getFolded()));
+	if (field == FIELD_HOST)
+		return (mask.Match(client.getInternedHostname().getFolded()));
+	return (mask.Match(client.getServername()) && !mask.Match(client.getInternedHostname().getFolded()));
+}
+
+void	UserIndex::_collect(const Node* node, const Mask& mask, Field field, size_t limit, std::vector<Client*>& found)
+{
+	for (size_t i = 0; i < node->clients.size() && found.size() < limit; i++)
+		if (_matches(*node->clients[i], mask, field))
+			found.push_back(node->clients[i]);
+	for (std::map<char, Node*>::const_iterator it = node->child.begin(); it != node->child.end() && found.size() < limit; ++it)
+		_collect(it->second, mask, field, limit, found);
+}
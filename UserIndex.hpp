@@ -0,0 +1,64 @@
+#ifndef USERINDEX_HPP
+#define USERINDEX_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+#include "Mask.hpp"
+
+class Client;
+
+/*
+ - Registered clients indexed for WHO <mask>, on casefolded keys (see _casefold()).
+ - A character trie on the nick answers "nick starts with", one on the reversed host answers
+   "host ends with" and one on the peer address (the servername) "address starts with": a
+   lookup walks the literal part of the mask, then only the subtree below, matching the mask
+   as it goes and stopping once it has found limit clients.
+ - A host mask is matched against both the hostname sent with USER and the peer address, the
+   way channel bans are (see Channel::isBanned()).
+ - Clients are referenced, not owned: they stay in the server's client list, which never moves
+   them, and have to be removed (or renamed) before their nick changes or they're destroyed.
+*/
+class UserIndex {
+	public:
+		UserIndex();
+		~UserIndex();
+
+		void	Add(Client& client);
+		void	Remove(Client& client);
+		void	Rename(Client& client, const std::string& old_nick);
+		void	FindNicks(const Mask& mask, size_t limit, std::vector<Client*>& found) const;
+		void	FindHosts(const Mask& mask, size_t limit, std::vector<Client*>& found) const;
+		size_t	Size() const;
+
+	private:
+		enum Field {
+			FIELD_NICK,
+			FIELD_HOST,
+			FIELD_ADDRESS // and not the host, those were found on the host trie
+		};
+
+		struct Node {
+			std::map<char, Node*>	child;
+			std::vector<Client*>	clients; // whose key ends on this node
+		};
+
+		Node	_nicks;
+		Node	_hosts;
+		Node	_addresses;
+		size_t	_size;
+
+		UserIndex(const UserIndex& copy);
+		UserIndex&	operator=(const UserIndex& copy);
+
+		static std::string	_host_key(const Client& client);
+		static void			_insert(Node* root, const std::string& key, Client* client);
+		static bool			_erase(Node* node, const std::string& key, size_t depth, Client* client);
+		static const Node*	_find(const Node* root, const std::string& key);
+		static bool			_holds(const Node* root, const std::string& key, Client* client);
+		static bool			_matches(const Client& client, const Mask& mask, Field field);
+		static void			_collect(const Node* node, const Mask& mask, Field field, size_t limit, std::vector<Client*>& found);
+		static void			_destroy(Node* node);
+};
+
+#endif // USERINDEX_HPP
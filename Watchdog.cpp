@@ -0,0 +1,168 @@
+#include <execinfo.h>
+#include <unistd.h>
+#include <cstring>
+#include "Watchdog.hpp"
+#include "Toolkit.hpp"
+
+static unsigned long long				s_threshold_ns = 0;
+static volatile sig_atomic_t			s_busy = 0;
+static volatile sig_atomic_t			s_reported = 0;
+static volatile unsigned long long		s_iteration_start = 0;
+static const char* volatile				s_what = "";
+static volatile int						s_client_fd = -1;
+static volatile int						s_current_record = -1;
+static volatile unsigned long long		s_stalls = 0;
+static StallRecord						s_ring[WATCHDOG_RING_SIZE];
+static struct itimerval					s_armed; // one-shot, the threshold
+static struct itimerval					s_disarmed;
+
+static void	_sig_write(const char* str)
+{
+	ssize_t ret = write(STDERR_FILENO, str, strlen(str));
+	(void)ret;
+}
+
+static void	_sig_write_num(unsigned long long num)
+{
+	char	buf[24];
+	size_t	i = sizeof(buf) - 1;
+
+	buf[i] = 0;
+	do {
+		buf[--i] = '0' + num % 10;
+		num /= 10;
+	} while (num && i > 0);
+	_sig_write(buf + i);
+}
+
+/*
+ - Disabled when threshold_ms <= 0, otherwise installs the SIGALRM handler the iterations
+   arm their timer for.
+*/
+bool	Watchdog::Start(long threshold_ms)
+{
+	struct sigaction	sa;
+	void*				warmup[1];
+
+	if (threshold_ms <= 0)
+		return 0;
+	// the first backtrace() call loads libgcc, which is not something to do inside a signal handler
+	backtrace(warmup, 1);
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = Watchdog::_handler;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGALRM, &sa, NULL) == -1)
+		return 1;
+	memset(&s_armed, 0, sizeof(s_armed));
+	memset(&s_disarmed, 0, sizeof(s_disarmed));
+	s_armed.it_value.tv_sec = threshold_ms / 1000;
+	s_armed.it_value.tv_usec = (threshold_ms % 1000) * 1000;
+	s_threshold_ns = threshold_ms * 1000000ULL;
+	std::cout << "Event loop watchdog armed, threshold " << threshold_ms << "ms" << std::endl;
+	return 0;
+}
+
+void	Watchdog::BeginIteration(void)
+{
+	s_iteration_start = _gettime_ns();
+	s_reported = 0;
+	s_what = "events";
+	s_client_fd = -1;
+	s_busy = 1;
+	if (s_threshold_ns)
+		setitimer(ITIMER_REAL, &s_armed, NULL);
+}
+
+void	Watchdog::EndIteration(void)
+{
+	s_busy = 0;
+	if (s_threshold_ns)
+		setitimer(ITIMER_REAL, &s_disarmed, NULL);
+	if (s_current_record >= 0) {
+		s_ring[s_current_record].finished_ns = _gettime_ns();
+		s_current_record = -1;
+	}
+}
+
+/*
+ - Records what the loop is currently doing, what must point to a string that outlives the call.
+*/
+void	Watchdog::Enter(const char* what, int client_fd)
+{
+	s_what = what;
+	s_client_fd = client_fd;
+}
+
+unsigned long long	Watchdog::getStallCount(void)
+{
+	return (s_stalls);
+}
+
+/*
+ - Runs on the loop thread, interrupting whatever is taking so long.
+ - Only async-signal-safe calls from here (write, clock_gettime, backtrace once warmed up).
+*/
+void	Watchdog::_handler(int signal_number)
+{
+	unsigned long long	now;
+	void*				frames[WATCHDOG_BACKTRACE_DEPTH];
+	int					depth;
+	int					index;
+	const char*			what = s_what;
+
+	(void)signal_number;
+	if (!s_busy || s_reported)
+		return ;
+	now = _gettime_ns();
+	if (now - s_iteration_start < s_threshold_ns)
+		return ;
+	s_reported = 1;
+	index = s_stalls % WATCHDOG_RING_SIZE;
+	for (size_t i = 0; i < WATCHDOG_NAME_LEN; i++) {
+		s_ring[index].command[i] = (i < WATCHDOG_NAME_LEN - 1 ? what[i] : 0);
+		if (!what[i])
+			break ;
+	}
+	s_ring[index].client_fd = s_client_fd;
+	s_ring[index].wall_time = time(NULL);
+	s_ring[index].started_ns = s_iteration_start;
+	s_ring[index].detected_ns = now;
+	s_ring[index].finished_ns = 0;
+	s_current_record = index;
+	++s_stalls;
+	_sig_write("Watchdog: event loop stalled for ");
+	_sig_write_num((now - s_iteration_start) / 1000000);
+	_sig_write("ms in ");
+	_sig_write(s_ring[index].command);
+	_sig_write(" (client fd ");
+	if (s_client_fd < 0)
+		_sig_write("none");
+	else
+		_sig_write_num(s_client_fd);
+	_sig_write("), loop backtrace:\n");
+	depth = backtrace(frames, WATCHDOG_BACKTRACE_DEPTH);
+	backtrace_symbols_fd(frames, depth, STDERR_FILENO);
+}
+
+void	Watchdog::Dump(std::ostream& os)
+{
+	unsigned long long	count = s_stalls;
+	unsigned long long	first = (count > WATCHDOG_RING_SIZE ? count - WATCHDOG_RING_SIZE : 0);
+
+	os << "Event loop stalls: " << count << std::endl;
+	for (unsigned long long n = first; n < count; n++)
+	{
+		const StallRecord&	record = s_ring[n % WATCHDOG_RING_SIZE];
+		char				date[32];
+
+		strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&record.wall_time));
+		os << "  [" << date << "] " << record.command << " fd " << record.client_fd
+		   << ", detected after " << (record.detected_ns - record.started_ns) / 1000000 << "ms";
+		if (record.finished_ns)
+			os << ", iteration took " << (record.finished_ns - record.started_ns) / 1000000 << "ms";
+		else
+			os << ", still running";
+		os << std::endl;
+	}
+}
@@ -0,0 +1,49 @@
+#ifndef WATCHDOG_HPP
+#define WATCHDOG_HPP
+
+#include <iostream>
+#include <string>
+#include <ctime>
+#include <signal.h>
+#include <sys/time.h>
+
+#define WATCHDOG_RING_SIZE 32
+#define WATCHDOG_BACKTRACE_DEPTH 32
+#define WATCHDOG_NAME_LEN 16
+
+/*
+ - One detected stall, written from the signal handler so it only holds plain data.
+*/
+struct StallRecord {
+	char				command[WATCHDOG_NAME_LEN];
+	int					client_fd;
+	time_t				wall_time;
+	unsigned long long	started_ns;
+	unsigned long long	detected_ns;
+	unsigned long long	finished_ns;
+};
+
+/*
+ - Event loop stall detector.
+ - The loop marks the start and end of every iteration and what it's working on, each
+   iteration arms a one-shot SIGALRM for the threshold and disarms it when done, so the signal
+   only comes for an iteration that runs too long and never wakes up a loop idle in poll().
+ - The signal is delivered to the loop thread itself (the server is single threaded),
+   so the handler can take a backtrace of the stalled stack directly and no watcher
+   thread is needed.
+ - Detected stalls are kept in a fixed ring buffer and printed with Dump().
+*/
+class Watchdog {
+	public:
+		static bool					Start(long threshold_ms);
+		static void					BeginIteration(void);
+		static void					EndIteration(void);
+		static void					Enter(const char* what, int client_fd);
+		static unsigned long long	getStallCount(void);
+		static void					Dump(std::ostream& os);
+
+	private:
+		static void					_handler(int signal_number);
+};
+
+#endif // WATCHDOG_HPP
@@ -0,0 +1,588 @@
+#include "Bench.hpp"
+#ifdef IRCSERV_TLS
+# include <cstdio>
+# include <cstdlib>
+# include <openssl/ssl.h>
+# include <openssl/pem.h>
+# include <openssl/x509.h>
+#endif
+
+Bench::Bench() : sink(0), fanout_channel(NULL)
+{
+	loopback_fds[0] = -1;
+	loopback_fds[1] = -1;
+#ifdef IRCSERV_TLS
+	tls_client_ctx = NULL;
+	tls_session = NULL;
+#endif
+	std::list<Channel>::iterator general;
+
+	general = std::find(server._channels.begin(), server._channels.end(), std::string("#general"));
+	general->setSize(-1);
+	for (int i = 0; i < 50; i++)
+	{
+		std::stringstream ss;
+		ss << "user" << i;
+		Client& client = add_user(ss.str());
+		general->join(client);
+	}
+	drain();
+}
+
+Bench::~Bench()
+{
+	delete fanout_channel;
+	for (int i = 0; i < 2; i++)
+		if (loopback_fds[i] >= 0)
+			close(loopback_fds[i]);
+#ifdef IRCSERV_TLS
+	SSL_SESSION_free((SSL_SESSION*)tls_session);
+	SSL_CTX_free((SSL_CTX*)tls_client_ctx);
+#endif
+}
+
+unsigned long long	Bench::now_ns() const
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+Client&	Bench::add_user(const std::string& nick)
+{
+	int fd = BENCH_FIRST_FD + server.clients.size();
+
+	server.InsertClient(fd);
+	Client& client = *server.GetClient(fd);
+	client.SetJustConnectedStatus(false);
+	client.SetNick(nick);
+	client.SetName(nick);
+	client.SetHostname("bench.example.com");
+	client.SetServername("127.0.0.1");
+	client.SetRealname("Bench User");
+	client.SetFloodExempt(true);
+	server._users.Add(client);
+	users.push_back(&client);
+	return (client);
+}
+
+void	Bench::set_line(Client& client, const std::string& line)
+{
+	client.SetBuffer(line);
+}
+
+/*
+ - Stands in for the end of tick flush: the fake fds can't be written to,
+   so the output queued for them is counted and dropped.
+*/
+void	Bench::drain()
+{
+	for (size_t i = 0; i < server.flush_queue.size(); i++)
+	{
+		sink += server.flush_queue[i]->QueuedBytes();
+		server.flush_queue[i]->DropMessages();
+		server.flush_queue[i]->SetFlushPending(false);
+	}
+	server.flush_queue.clear();
+}
+
+/*
+ - Doubles the iteration count until one run lasts at least BENCH_MIN_NS,
+   then reports that run.
+ - std::cout is detached while the case runs so the server's debug logging
+   doesn't end up in the numbers.
+*/
+void	Bench::measure(const std::string& name, BenchFn fn)
+{
+	size_t				iterations = 1;
+	unsigned long long	start, elapsed;
+	size_t				allocs;
+	std::streambuf*		out = std::cout.rdbuf(NULL);
+
+	while (SRH)
+	{
+		g_bench_allocs = 0;
+		start = now_ns();
+		(this->*fn)(iterations);
+		elapsed = now_ns() - start;
+		allocs = g_bench_allocs;
+		if (elapsed >= BENCH_MIN_NS || iterations >= (1UL << 26))
+			break ;
+		iterations *= 2;
+	}
+	std::cout.rdbuf(out);
+	std::cout << std::left << std::setw(34) << name
+			  << std::right << std::setw(12) << iterations
+			  << std::setw(14) << std::fixed << std::setprecision(1) << (double)elapsed / iterations
+			  << std::setw(14) << std::setprecision(2) << (double)allocs / iterations << std::endl;
+}
+
+void	Bench::parse_privmsg(size_t iterations)
+{
+	Client&				client = *users[0];
+	Parse				data(client);
+	const std::string	line("PRIVMSG #general :hello there, this is a typical chat line");
+
+	server._data = &data;
+	for (size_t i = 0; i < iterations; i++)
+		server.CreateCommandData(line, MSGINCLUDED);
+	sink += data.getMessage().size();
+}
+
+void	Bench::parse_join(size_t iterations)
+{
+	Client&				client = *users[0];
+	Parse				data(client);
+	const std::string	line("JOIN #hmeftah hmeftah");
+
+	server._data = &data;
+	for (size_t i = 0; i < iterations; i++)
+		server.CreateCommandData(line, MSGNOTINCLUDED);
+	sink += data.getArgs().size();
+}
+
+void	Bench::interpret_privmsg(size_t iterations)
+{
+	Client& client = *users[1];
+
+	for (size_t i = 0; i < iterations; i++)
+	{
+		set_line(client, "PRIVMSG user2 :hello there, this is a typical chat line\r\n");
+		server.Interpreter(client.getSockID());
+		drain();
+	}
+}
+
+/*
+ - Runs one command line from users[0] through the dispatch table, iterations times.
+*/
+void	Bench::dispatch(const char* line, CommandType type, size_t iterations)
+{
+	Client& client = *users[0];
+	Parse	data(client);
+
+	server._data = &data;
+	server.CreateCommandData(line, type);
+	for (size_t i = 0; i < iterations; i++)
+	{
+		server.ExecuteCommand();
+		drain();
+	}
+}
+
+void	Bench::dispatch_privmsg_channel(size_t iterations)
+{
+	dispatch("PRIVMSG #general :hello there, this is a typical chat line", MSGINCLUDED, iterations);
+}
+
+void	Bench::dispatch_privmsg_user(size_t iterations)
+{
+	dispatch("PRIVMSG user42 :hello there, this is a typical chat line", MSGINCLUDED, iterations);
+}
+
+void	Bench::dispatch_privmsg_multi(size_t iterations)
+{
+	dispatch("PRIVMSG user41,user42,user43,user44 :hello there, this is a typical chat line", MSGINCLUDED, iterations);
+}
+
+void	Bench::dispatch_who(size_t iterations)
+{
+	dispatch("WHO #general", MSGNOTINCLUDED, iterations);
+}
+
+void	Bench::dispatch_names(size_t iterations)
+{
+	dispatch("NAMES #general", MSGNOTINCLUDED, iterations);
+}
+
+void	Bench::dispatch_who_mask(size_t iterations)
+{
+	dispatch("WHO User4*", MSGNOTINCLUDED, iterations);
+}
+
+void	Bench::dispatch_mode(size_t iterations)
+{
+	dispatch("MODE #general -t+t", MSGNOTINCLUDED, iterations);
+}
+
+void	Bench::format_user_info(size_t iterations)
+{
+	Client& client = *users[3];
+
+	for (size_t i = 0; i < iterations; i++)
+		sink += _user_info(client, true).size();
+}
+
+void	Bench::format_numeric(size_t iterations)
+{
+	Client&		client = *users[3];
+	std::string	target("nobody");
+
+	for (size_t i = 0; i < iterations; i++)
+		sink += (_user_info(client, false) + ERR_NOSUCHNICK(client.getNick(), target)).size();
+}
+
+/*
+ - A ban list shaped like a busy channel's: host and domain bans, nick and ident patterns,
+   address ranges, and subjects that mostly get through it.
+*/
+void	Bench::mask_setup()
+{
+	const char*	shapes[][2] = { { "*!*@host", ".isp.example.net" }, { "*!*@*.dyn", ".example.org" }, { "Spam", "*!*@*" },
+								{ "*!~user", "@*" }, { "*!*@203.0.", ".*" }, { "*!*bot", "*@*" }, { "*!*@*", ".cloak.IRC" } };
+	const size_t	shape_count = sizeof(shapes) / sizeof(shapes[0]);
+
+	for (size_t i = 0; i < BENCH_MASKS; i++)
+	{
+		std::stringstream mask;
+
+		mask << shapes[i % shape_count][0] << i * 7 << shapes[i % shape_count][1];
+		masks.push_back(Mask(mask.str()));
+		bans.Add(mask.str(), "bench", "0");
+	}
+	for (int i = 0; i < 16; i++)
+	{
+		std::stringstream subject;
+
+		subject << "Nick" << i << "!~ident" << i << "@host" << i * 3 << ".isp.example.net";
+		mask_subjects.push_back(_casefold(subject.str()));
+	}
+}
+
+void	Bench::ban_match(size_t iterations)
+{
+	for (size_t i = 0; i < iterations; i++)
+		sink += bans.Match(mask_subjects[i % mask_subjects.size()]);
+}
+
+void	Bench::mask_match(size_t iterations)
+{
+	for (size_t i = 0; i < iterations; i++)
+	{
+		const std::string&	subject = mask_subjects[i % mask_subjects.size()];
+
+		for (size_t m = 0; m < masks.size(); m++)
+			sink += masks[m].Match(subject);
+	}
+}
+
+void	Bench::fanout(size_t iterations)
+{
+	Client&		sender = *users[0];
+	std::string	msg = _user_info(sender, true) + "PRIVMSG #fanout :hello there, this is a typical chat line\r\n";
+
+	for (size_t i = 0; i < iterations; i++)
+	{
+		fanout_channel->sendToAll(sender, msg);
+		drain();
+	}
+}
+
+/*
+ - A QUIT seen by the 49 users sharing #general and BENCH_SHARED_CHANNELS more channels
+   with the sender, each of them gets it once.
+*/
+void	Bench::fanout_neighbors(size_t iterations)
+{
+	Client&		sender = *users[0];
+	std::string	msg = _user_info(sender, true) + "QUIT :Quit: Leaving\r\n";
+
+	for (size_t i = 0; i < iterations; i++)
+	{
+		server.SendToNeighbors(sender, msg);
+		drain();
+	}
+}
+
+/*
+ - Registers two clients on an in-process server, the server side of each
+   connection is one end of a socketpair so the event loop runs unmodified.
+*/
+bool	Bench::loopback_setup()
+{
+	const char*	nicks[2] = { "lo_sender", "lo_receiver" };
+	char		buf[4096];
+
+	if (loopback.CreateLoopbackServer("bench"))
+		return false;
+	for (int i = 0; i < 2; i++)
+	{
+		std::string registration = std::string("PASS bench\r\nNICK ") + nicks[i] + "\r\nUSER " + nicks[i] + " 0 * :" + nicks[i] + "\r\n";
+
+		loopback_fds[i] = loopback.ConnectLoopback();
+		if (loopback_fds[i] < 0)
+			return false;
+		fcntl(loopback_fds[i], F_SETFL, O_NONBLOCK);
+		send(loopback_fds[i], registration.c_str(), registration.length(), 0);
+	}
+	for (int tick = 0; tick < 8; tick++)
+		loopback.OnServerTick(0);
+	for (std::list<Client>::iterator it = loopback.clients.begin(); it != loopback.clients.end(); ++it)
+		it->SetFloodExempt(true);
+	for (int i = 0; i < 2; i++)
+		while (recv(loopback_fds[i], buf, sizeof(buf), 0) > 0)
+			;
+	return true;
+}
+
+/*
+ - Full server round trip for one message: the sender's line is read, parsed, dispatched
+   and written to the receiver, driven one OnServerTick() at a time.
+*/
+void	Bench::loopback_privmsg(size_t iterations)
+{
+	const char	line[] = "PRIVMSG lo_receiver :hello there, this is a typical chat line\r\n";
+	char		buf[4096];
+
+	for (size_t i = 0; i < iterations; i++)
+	{
+		send(loopback_fds[0], line, sizeof(line) - 1, 0);
+		while (SRH)
+		{
+			loopback.OnServerTick(0);
+			if (recv(loopback_fds[1], buf, sizeof(buf), 0) > 0)
+				break ;
+		}
+	}
+}
+
+/*
+ - PING/PONG round trips against a server running its real event loop (Run()) in a child
+   process, so every message pays for the server's poll() wakeup, which is what the spin
+   budget of SetLowLatencyMode() is meant to remove. The client side blocks in poll().
+*/
+void	Bench::ping_latency(const std::string& name, long spin_us)
+{
+	const char		ping[] = "PING :bench\r\n";
+	char			buf[4096];
+	int				sv[2];
+	pid_t			pid;
+	Histogram		rtt;
+	struct pollfd	pfd;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+		return ;
+	pid = fork();
+	if (pid == 0)
+	{
+		Server	child;
+
+		std::cout.rdbuf(NULL);
+		close(sv[0]);
+		child.CreateLoopbackServer("bench");
+		child.SetLowLatencyMode(-1, 0, spin_us);
+		child.AttachConnection(sv[1]);
+		child.clients.back().SetFloodExempt(true);
+		child.Run();
+		_exit(0);
+	}
+	close(sv[1]);
+	std::string registration("PASS bench\r\nNICK pinger\r\nUSER pinger 0 * :pinger\r\n");
+	send(sv[0], registration.c_str(), registration.length(), 0);
+	pfd.fd = sv[0];
+	pfd.events = POLLIN;
+	for (size_t i = 0; pid > 0 && i < BENCH_RTT_SAMPLES + BENCH_RTT_SAMPLES / 10; i++)
+	{
+		unsigned long long	start = now_ns();
+		ssize_t				rb = 0;
+
+		send(sv[0], ping, sizeof(ping) - 1, 0);
+		while (rb <= 0 || buf[rb - 1] != '\n')
+		{
+			poll(&pfd, 1, -1);
+			rb = recv(sv[0], buf, sizeof(buf), 0);
+			if (rb == 0)
+				break ;
+		}
+		if (i >= BENCH_RTT_SAMPLES / 10)
+			rtt.Observe(now_ns() - start);
+	}
+	if (pid > 0)
+	{
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+	}
+	close(sv[0]);
+	std::cout << std::left << std::setw(34) << name
+			  << std::right << std::setw(12) << rtt.getCount()
+			  << std::setw(12) << rtt.Percentile(0.5)
+			  << std::setw(12) << rtt.Percentile(0.99)
+			  << std::setw(12) << rtt.Percentile(0.999)
+			  << std::setw(12) << rtt.getMax() << std::endl;
+}
+
+#ifdef IRCSERV_TLS
+/*
+ - Loads a throwaway self-signed P-256 certificate into the bench's TlsContext, the same
+   context the server runs its listener with, and keeps a session for the resumed case.
+*/
+bool	Bench::tls_setup()
+{
+	char			path[] = "/tmp/ircserv_bench_tlsXXXXXX";
+	int				fd = mkstemp(path);
+	FILE*			file = (fd >= 0 ? fdopen(fd, "w") : NULL);
+	EVP_PKEY*		pkey = NULL;
+	EVP_PKEY_CTX*	kctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+	X509*			cert = X509_new();
+	bool			ok = false;
+
+	if (file && kctx && cert && EVP_PKEY_keygen_init(kctx) > 0
+		&& EVP_PKEY_CTX_set_ec_paramgen_curve_nid(kctx, NID_X9_62_prime256v1) > 0
+		&& EVP_PKEY_keygen(kctx, &pkey) > 0)
+	{
+		X509_set_version(cert, 2);
+		ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+		X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+		X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+		X509_set_pubkey(cert, pkey);
+		X509_NAME_add_entry_by_txt(X509_get_subject_name(cert), "CN", MBSTRING_ASC, (const unsigned char*)"ircserv-bench", -1, -1, 0);
+		X509_set_issuer_name(cert, X509_get_subject_name(cert));
+		ok = X509_sign(cert, pkey, EVP_sha256()) > 0 && PEM_write_X509(file, cert) && PEM_write_PrivateKey(file, pkey, NULL, NULL, 0, NULL, NULL);
+	}
+	if (file)
+		fclose(file);
+	ok = ok && tls.Init(path, path, false);
+	if (fd >= 0)
+		unlink(path);
+	X509_free(cert);
+	EVP_PKEY_free(pkey);
+	EVP_PKEY_CTX_free(kctx);
+	tls_client_ctx = SSL_CTX_new(TLS_client_method());
+	if (!ok || !tls_client_ctx)
+		return false;
+	SSL_CTX_set_session_cache_mode((SSL_CTX*)tls_client_ctx, SSL_SESS_CACHE_CLIENT);
+	return (tls_handshake(false) && tls_session);
+}
+
+/*
+ - One handshake over a socketpair, the client stepped with SSL_do_handshake() and the
+   server side through TlsContext::Read() like a TLS client of the event loop.
+ - Whatever the server sends after its Finished (TLS 1.3 session tickets) is read too,
+   the session is kept for the next resumed handshake.
+*/
+bool	Bench::tls_handshake(bool resume)
+{
+	int				sv[2];
+	char			buf[TLS_RECORD_SIZE];
+	SSL*			client;
+	TlsConnection*	conn;
+	bool			done = false;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+		return false;
+	fcntl(sv[0], F_SETFL, O_NONBLOCK);
+	fcntl(sv[1], F_SETFL, O_NONBLOCK);
+	client = SSL_new((SSL_CTX*)tls_client_ctx);
+	conn = tls.Accept(sv[1]);
+	SSL_set_fd(client, sv[0]);
+	SSL_set_connect_state(client);
+	if (resume)
+		SSL_set_session(client, (SSL_SESSION*)tls_session);
+	for (int step = 0; !done && step < 16; step++)
+	{
+		SSL_do_handshake(client);
+		if (tls.Read(conn, buf, sizeof(buf)) < 0)
+			break ;
+		done = conn->established && SSL_is_init_finished(client);
+	}
+	SSL_read(client, buf, sizeof(buf));
+	if (done)
+	{
+		// clients resume with the newest ticket, OpenSSL doesn't take one back twice
+		SSL_SESSION_free((SSL_SESSION*)tls_session);
+		tls_session = SSL_get1_session(client);
+	}
+	sink += SSL_session_reused(client);
+	SSL_shutdown(client); // freed without a close_notify, the session would be dropped from the cache
+	SSL_free(client);
+	tls.Close(conn);
+	close(sv[0]);
+	close(sv[1]);
+	return (done);
+}
+
+void	Bench::tls_handshake_full(size_t iterations)
+{
+	for (size_t i = 0; i < iterations; i++)
+		tls_handshake(false);
+}
+
+void	Bench::tls_handshake_resumed(size_t iterations)
+{
+	for (size_t i = 0; i < iterations; i++)
+		tls_handshake(true);
+}
+#endif
+
+void	Bench::run()
+{
+	size_t			members[4] = { 1, 10, 100, 1000 };
+
+	std::cout << std::left << std::setw(34) << "benchmark"
+			  << std::right << std::setw(12) << "iterations"
+			  << std::setw(14) << "ns/op"
+			  << std::setw(14) << "allocs/op" << std::endl;
+	measure("parse/privmsg", &Bench::parse_privmsg);
+	measure("parse/join", &Bench::parse_join);
+	measure("interpret/privmsg_user", &Bench::interpret_privmsg);
+	measure("dispatch/privmsg_channel_50", &Bench::dispatch_privmsg_channel);
+	measure("dispatch/privmsg_user", &Bench::dispatch_privmsg_user);
+	measure("dispatch/privmsg_4_users", &Bench::dispatch_privmsg_multi);
+	measure("dispatch/who_50", &Bench::dispatch_who);
+	measure("dispatch/names_50", &Bench::dispatch_names);
+	measure("dispatch/who_mask_nick_50", &Bench::dispatch_who_mask);
+	measure("dispatch/mode_50", &Bench::dispatch_mode);
+	measure("format/user_info", &Bench::format_user_info);
+	measure("format/numeric", &Bench::format_numeric);
+	mask_setup();
+	measure("mask/match_100", &Bench::mask_match);
+	measure("ban/match_100", &Bench::ban_match);
+	for (size_t m = 0; m < 4; m++)
+	{
+		std::stringstream name;
+
+		delete fanout_channel;
+		fanout_channel = new Channel("#fanout");
+		fanout_channel->setSize(-1);
+		while (users.size() < members[m] + 1)
+		{
+			std::stringstream nick;
+			nick << "user" << users.size();
+			add_user(nick.str());
+		}
+		for (size_t i = 1; i <= members[m]; i++)
+			fanout_channel->join(*users[i]);
+		name << "fanout/sendToAll_" << members[m];
+		measure(name.str(), &Bench::fanout);
+	}
+	for (int c = 0; c < BENCH_SHARED_CHANNELS; c++)
+	{
+		std::stringstream name;
+
+		name << "#shared" << c;
+		server._channels.push_back(Channel(name.str()));
+		server._channels.back().setSize(-1);
+		for (size_t i = 0; i < 50; i++)
+			server._channels.back().join(*users[i]);
+	}
+	drain();
+	measure("fanout/neighbors_6_channels_50", &Bench::fanout_neighbors);
+	if (loopback_setup())
+		measure("loopback/privmsg_relay", &Bench::loopback_privmsg);
+#ifdef IRCSERV_TLS
+	if (tls_setup())
+	{
+		measure("tls/handshake_full", &Bench::tls_handshake_full);
+		measure("tls/handshake_resumed", &Bench::tls_handshake_resumed);
+	}
+#endif
+	std::cout << std::endl << std::left << std::setw(34) << "round trip (ns)"
+			  << std::right << std::setw(12) << "samples"
+			  << std::setw(12) << "p50"
+			  << std::setw(12) << "p99"
+			  << std::setw(12) << "p99.9"
+			  << std::setw(12) << "max" << std::endl;
+	ping_latency("latency/ping_blocking", 0);
+	ping_latency("latency/ping_spin_100us", 100);
+	std::cout << "checksum: " << sink << std::endl;
+}
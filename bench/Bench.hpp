@@ -0,0 +1,92 @@
+#ifndef BENCH_HPP
+#define BENCH_HPP
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <list>
+#include <ctime>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include "../Server.hpp"
+#include "../Client.hpp"
+#include "../Channel.hpp"
+#include "../Parse.hpp"
+
+#define BENCH_MIN_NS 100000000ULL
+#define BENCH_FIRST_FD 100000
+#define BENCH_RTT_SAMPLES 20000
+#define BENCH_SHARED_CHANNELS 5
+#define BENCH_MASKS 100
+
+extern size_t	g_bench_allocs;
+
+/*
+ - Runs the server hot paths (parsing, dispatch, reply formatting and channel fan-out)
+   in isolation: clients are registered with fake file descriptors and nothing touches a socket.
+ - Every case reports the mean wall time and the number of operator new calls per operation.
+*/
+class Bench
+{
+	private:
+		Server					server;
+		Server					loopback;
+		int						loopback_fds[2];
+		std::vector<Client*>	users;
+		size_t					sink;
+
+		typedef void (Bench::*BenchFn)(size_t iterations);
+
+		unsigned long long	now_ns() const;
+		void				measure(const std::string& name, BenchFn fn);
+		Client&				add_user(const std::string& nick);
+		void				set_line(Client& client, const std::string& line);
+		void				drain();
+		void				dispatch(const char* line, CommandType type, size_t iterations);
+
+		void				parse_privmsg(size_t iterations);
+		void				parse_join(size_t iterations);
+		void				interpret_privmsg(size_t iterations);
+		void				dispatch_privmsg_channel(size_t iterations);
+		void				dispatch_privmsg_user(size_t iterations);
+		void				dispatch_privmsg_multi(size_t iterations);
+		void				dispatch_who(size_t iterations);
+		void				dispatch_names(size_t iterations);
+		void				dispatch_who_mask(size_t iterations);
+		void				dispatch_mode(size_t iterations);
+		void				format_user_info(size_t iterations);
+		void				format_numeric(size_t iterations);
+		void				mask_setup();
+		void				mask_match(size_t iterations);
+		void				ban_match(size_t iterations);
+		void				fanout(size_t iterations);
+		void				fanout_neighbors(size_t iterations);
+		bool				loopback_setup();
+		void				loopback_privmsg(size_t iterations);
+		void				ping_latency(const std::string& name, long spin_us);
+#ifdef IRCSERV_TLS
+		TlsContext			tls;
+		void*				tls_client_ctx;
+		void*				tls_session;
+		bool				tls_setup();
+		bool				tls_handshake(bool resume);
+		void				tls_handshake_full(size_t iterations);
+		void				tls_handshake_resumed(size_t iterations);
+#endif
+
+		Channel*			fanout_channel;
+		std::vector<Mask>			masks;
+		std::vector<std::string>	mask_subjects; // folded nick!user@host
+		BanList						bans; // the same masks as a channel's +b list
+
+	public:
+		Bench();
+		~Bench();
+		void	run();
+};
+
+#endif
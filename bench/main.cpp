@@ -0,0 +1,39 @@
+#include <cstdlib>
+#include <new>
+#include "Bench.hpp"
+
+size_t	g_bench_allocs = 0;
+
+void*	operator new(size_t size) throw(std::bad_alloc)
+{
+	void* ptr;
+
+	++g_bench_allocs;
+	ptr = std::malloc(size ? size : 1);
+	if (!ptr)
+		throw std::bad_alloc();
+	return (ptr);
+}
+
+void*	operator new[](size_t size) throw(std::bad_alloc)
+{
+	return (operator new(size));
+}
+
+void	operator delete(void* ptr) throw()
+{
+	std::free(ptr);
+}
+
+void	operator delete[](void* ptr) throw()
+{
+	std::free(ptr);
+}
+
+int main(void)
+{
+	Bench bench;
+
+	bench.run();
+	return 0;
+}
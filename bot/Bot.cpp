@@ -42,15 +42,20 @@ Bot::Bot(const std::string &port, const std::string &pass)
     this->Forbidden_msg.push_back("amzgis");
     this->Forbidden_msg.push_back("yassin");
     _bzero(&this->hints, sizeof(this->hints));
-    this->hints.ai_family = AF_INET;
-	this->hints.ai_socktype = SOCK_STREAM;
-    if (getaddrinfo(NULL , port.c_str(), &this->hints, &this->res))
-        throw std::runtime_error("getaddrinfo failed");
-    this->socket_id = socket(this->hints.ai_family, this->hints.ai_socktype, this->hints.ai_protocol);
-    if(this->socket_id == -1)
-        throw std::runtime_error("socket failed");
-    if (connect(this->socket_id, res->ai_addr, res->ai_addrlen))
-        throw std::runtime_error("connect failed");
+    if (port.find('/') != std::string::npos)
+        connect_local(port);
+    else
+    {
+        this->hints.ai_family = AF_INET;
+        this->hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(NULL , port.c_str(), &this->hints, &this->res))
+            throw std::runtime_error("getaddrinfo failed");
+        this->socket_id = socket(this->hints.ai_family, this->hints.ai_socktype, this->hints.ai_protocol);
+        if(this->socket_id == -1)
+            throw std::runtime_error("socket failed");
+        if (connect(this->socket_id, res->ai_addr, res->ai_addrlen))
+            throw std::runtime_error("connect failed");
+    }
     std::string tmp = "CAP LS\r\nNICK irc_bot\r\nUSER irc_bot irc_bot localhost :irc_bot\r\nPASS " + pass;
     const char *msg = tmp.c_str();
     send(this->socket_id, msg, strlen(msg), 0);
@@ -61,6 +66,26 @@ Bot::~Bot()
 {
 }
 
+/*
+ - Connects to the server's unix socket (IRCSERV_UNIX_SOCKET) instead of TCP loopback,
+   a bot running as the server's user is flood exempt there.
+*/
+void Bot::connect_local(const std::string &path)
+{
+    struct sockaddr_un addr;
+
+    if (path.length() >= sizeof(addr.sun_path))
+        throw std::runtime_error("socket path too long");
+    _bzero(&addr, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path.c_str());
+    this->socket_id = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(this->socket_id == -1)
+        throw std::runtime_error("socket failed");
+    if (connect(this->socket_id, (struct sockaddr *)&addr, sizeof(addr)))
+        throw std::runtime_error("connect failed");
+}
+
 void Bot::init_jokes()
 {
     jokes.push_back("A taxing situation: According to unofficial sources, a new simplified income-tax form contains only four lines.");
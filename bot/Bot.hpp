@@ -21,6 +21,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <unistd.h>
 #include <netdb.h>
 #include "../Client.hpp"
@@ -59,6 +60,7 @@ private:
 	void parse_command(std::string command);
 	void check_conversation(std::vector<std::string> &conversation);
 	void join_channesl();
+	void connect_local(const std::string &path);
 public:
 	Bot(const std::string &port, const std::string &pass);
 	void run_bot();
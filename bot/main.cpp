@@ -44,6 +44,6 @@ int main(int ac, char **av)
 		}
 	}
 	else
-		std::cerr << "Usage: ./bot port password" << std::endl;
+		std::cerr << "Usage: ./bot <port|socket path> password" << std::endl;
 	return 0;
 }
@@ -25,6 +25,7 @@ int main(int ac, char  **av) {
 		Server ServerHandler;
 		if (ServerHandler.CreateServer(av[1], av[2]))
 			return 1;
+		ServerHandler.Run();
 	}
 	else {
 		std::cerr << "GUIDE: ./ircserv port password" << std::endl;